@@ -0,0 +1,305 @@
+/*************************************************************************
+	
+	SPI NOR flash driver by Julien Delvaux
+
+*************************************************************************/
+
+#include "NOR.h"
+
+#if defined (SPI_MASTER_ENABLED)
+
+/************************************************************************/
+/* Constants and macros                                                 */
+/************************************************************************/
+
+#define NOR_CMD_WRITE_ENABLE	0x06
+#define NOR_CMD_READ_STATUS		0x05
+#define NOR_CMD_FAST_READ		0x0B
+#define NOR_CMD_PAGE_PROGRAM	0x02
+#define NOR_CMD_SECTOR_ERASE	0x20
+#define NOR_CMD_BLOCK_ERASE		0xD8
+#define NOR_CMD_CHIP_ERASE		0xC7
+#define NOR_CMD_READ_ID			0x9F
+#define NOR_CMD_WAKE_UP			0xAB
+
+#define NOR_STATUS_WIP			0x01	// Write in progress
+
+#if ( NOR_PAGE_SIZE & (NOR_PAGE_SIZE - 1) )
+	#error NOR page size is not a power of 2
+#endif
+
+/*************************************************************************
+Function: nor_begin()
+Purpose:  take the bus in mode 0, MSB first, at the flash clock
+Input:    none
+Returns:  none
+**************************************************************************/
+static void nor_begin(void){
+	
+	spi_master_acquire_settings(SPI_MODE0, NOR_CLOCK, SPI_MSBFIRST);
+}
+
+/*************************************************************************
+Function: nor_command()
+Purpose:  select the chip and send a command with a 24-bit address
+Input:    command, address
+Returns:  none
+**************************************************************************/
+static void nor_command(uint8_t command, uint32_t address){
+	
+	uint8_t frame[4];
+	
+	frame[0] = command;
+	frame[1] = address >> 16;
+	frame[2] = address >> 8;
+	frame[3] = address;
+	
+	SPI_IO_LOW(NOR_CS);
+	spi_master_write_block(frame, sizeof(frame));
+}
+
+/*************************************************************************
+Function: nor_wait()
+Purpose:  wait for WIP to clear, the bus must be taken
+          The chip repeats the status register as long as it is selected,
+          so one command covers the whole wait
+Input:    none
+Returns:  NOR_OK, NOR_ERROR_TIMEOUT if still busy after NOR_POLL_BUSY bytes
+**************************************************************************/
+static uint8_t nor_wait(void){
+	
+	uint32_t polls = NOR_POLL_BUSY;
+	uint8_t result = NOR_ERROR_TIMEOUT;
+	
+	SPI_IO_LOW(NOR_CS);
+	spi_master_exchange(NOR_CMD_READ_STATUS);
+	while (polls--) {
+		if (!(spi_master_exchange(0xFF) & NOR_STATUS_WIP)) {
+			result = NOR_OK;
+			break;
+		}
+	}
+	SPI_IO_HIGH(NOR_CS);
+	
+	return result;
+}
+
+/*************************************************************************
+Function: nor_write_enable()
+Purpose:  wait for the previous operation then set the write enable latch
+Input:    none
+Returns:  NOR_OK or NOR_ERROR_TIMEOUT, the latch is not set then
+**************************************************************************/
+static uint8_t nor_write_enable(void){
+	
+	if (nor_wait() != NOR_OK) {
+		return NOR_ERROR_TIMEOUT;
+	}
+	SPI_IO_LOW(NOR_CS);
+	spi_master_exchange(NOR_CMD_WRITE_ENABLE);
+	SPI_IO_HIGH(NOR_CS);
+	
+	return NOR_OK;
+}
+
+/*************************************************************************
+Function: nor_init()
+Purpose:  Configure the chip select pin and wake the chip up
+Input:    none
+Returns:  none
+**************************************************************************/
+void nor_init(void){
+	
+	SPI_IO_HIGH(NOR_CS);
+	SPI_IO_OUTPUT(NOR_CS);
+	
+	nor_begin();
+	SPI_IO_LOW(NOR_CS);
+	spi_master_exchange(NOR_CMD_WAKE_UP);
+	SPI_IO_HIGH(NOR_CS);
+	spi_master_release();
+}
+
+/*************************************************************************
+Function: nor_read_id()
+Purpose:  Read the JEDEC identification
+Input:    buffer of 3 bytes
+Returns:  NOR_OK or NOR_ERROR_TIMEOUT
+**************************************************************************/
+uint8_t nor_read_id(uint8_t *id){
+	
+	uint8_t result;
+	
+	nor_begin();
+	result = nor_wait();
+	if (result == NOR_OK) {
+		SPI_IO_LOW(NOR_CS);
+		spi_master_exchange(NOR_CMD_READ_ID);
+		spi_master_read_block(id, 3, 0xFF);
+		SPI_IO_HIGH(NOR_CS);
+	}
+	spi_master_release();
+	
+	return result;
+}
+
+/*************************************************************************
+Function: nor_busy()
+Purpose:  Tell if a program or erase is in progress
+Input:    none
+Returns:  1 if busy, 0 if ready
+**************************************************************************/
+uint8_t nor_busy(void){
+	
+	uint8_t status;
+	
+	nor_begin();
+	SPI_IO_LOW(NOR_CS);
+	spi_master_exchange(NOR_CMD_READ_STATUS);
+	status = spi_master_exchange(0xFF);
+	SPI_IO_HIGH(NOR_CS);
+	spi_master_release();
+	
+	return (status & NOR_STATUS_WIP) ? 1 : 0;
+}
+
+/*************************************************************************
+Function: nor_wait_ready()
+Purpose:  Wait for the end of a program or erase
+Input:    none
+Returns:  NOR_OK or NOR_ERROR_TIMEOUT
+**************************************************************************/
+uint8_t nor_wait_ready(void){
+	
+	uint8_t result;
+	
+	nor_begin();
+	result = nor_wait();
+	spi_master_release();
+	
+	return result;
+}
+
+/*************************************************************************
+Function: nor_read()
+Purpose:  Stream bytes with Fast Read into a buffer
+Input:    address, buffer, number of bytes
+Returns:  NOR_OK or NOR_ERROR_TIMEOUT
+**************************************************************************/
+uint8_t nor_read(uint32_t address, uint8_t *data, uint16_t length){
+	
+	uint8_t result;
+	
+	nor_begin();
+	result = nor_wait();
+	if (result == NOR_OK) {
+		nor_command(NOR_CMD_FAST_READ, address);
+		spi_master_exchange(0xFF); // dummy byte
+		spi_master_read_block(data, length, 0xFF);
+		SPI_IO_HIGH(NOR_CS);
+	}
+	spi_master_release();
+	
+	return result;
+}
+
+/*************************************************************************
+Function: nor_program()
+Purpose:  Program bytes page by page, return without waiting for the last
+Input:    address, bytes to program, number of bytes
+Returns:  NOR_OK or NOR_ERROR_TIMEOUT, the pages before are programmed
+**************************************************************************/
+uint8_t nor_program(uint32_t address, const uint8_t *data, uint16_t length){
+	
+	uint16_t chunk;
+	uint8_t result = NOR_OK;
+	
+	nor_begin();
+	while (length) {
+		// a page program wraps inside its page, stop at the boundary
+		chunk = NOR_PAGE_SIZE - (address & (NOR_PAGE_SIZE - 1));
+		if (chunk > length) {
+			chunk = length;
+		}
+		result = nor_write_enable();
+		if (result != NOR_OK) {
+			break;
+		}
+		nor_command(NOR_CMD_PAGE_PROGRAM, address);
+		spi_master_write_block(data, chunk);
+		SPI_IO_HIGH(NOR_CS);
+		
+		address += chunk;
+		data += chunk;
+		length -= chunk;
+	}
+	spi_master_release();
+	
+	return result;
+}
+
+/*************************************************************************
+Function: nor_erase_sector()
+Purpose:  Erase a 4KB sector, return without waiting
+Input:    address inside the sector
+Returns:  NOR_OK or NOR_ERROR_TIMEOUT
+**************************************************************************/
+uint8_t nor_erase_sector(uint32_t address){
+	
+	uint8_t result;
+	
+	nor_begin();
+	result = nor_write_enable();
+	if (result == NOR_OK) {
+		nor_command(NOR_CMD_SECTOR_ERASE, address);
+		SPI_IO_HIGH(NOR_CS);
+	}
+	spi_master_release();
+	
+	return result;
+}
+
+/*************************************************************************
+Function: nor_erase_block()
+Purpose:  Erase a 64KB block, return without waiting
+Input:    address inside the block
+Returns:  NOR_OK or NOR_ERROR_TIMEOUT
+**************************************************************************/
+uint8_t nor_erase_block(uint32_t address){
+	
+	uint8_t result;
+	
+	nor_begin();
+	result = nor_write_enable();
+	if (result == NOR_OK) {
+		nor_command(NOR_CMD_BLOCK_ERASE, address);
+		SPI_IO_HIGH(NOR_CS);
+	}
+	spi_master_release();
+	
+	return result;
+}
+
+/*************************************************************************
+Function: nor_erase_chip()
+Purpose:  Erase the whole chip, return without waiting
+Input:    none
+Returns:  NOR_OK or NOR_ERROR_TIMEOUT
+**************************************************************************/
+uint8_t nor_erase_chip(void){
+	
+	uint8_t result;
+	
+	nor_begin();
+	result = nor_write_enable();
+	if (result == NOR_OK) {
+		SPI_IO_LOW(NOR_CS);
+		spi_master_exchange(NOR_CMD_CHIP_ERASE);
+		SPI_IO_HIGH(NOR_CS);
+	}
+	spi_master_release();
+	
+	return result;
+}
+
+#endif
@@ -0,0 +1,162 @@
+/************************************************************************
+Title:    25-series SPI NOR flash driver over the SPI master
+Author:   Julien Delvaux
+Software: Atmel Studio 7
+Hardware: AVR 8-Bits, tested with ATmega1284P and ATmega88PA-PU
+License:  GNU General Public License 3
+Usage:    see Doxygen manual
+
+
+
+LICENSE:
+	Copyright (C) 2015 Julien Delvaux
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+    
+************************************************************************/
+
+/** 
+ *  @defgroup avr-spi-nor NOR Library
+ *  @code #include <NOR.h> @endcode
+ * 
+ *  @brief 25-series SPI NOR flash driver using the SPI master. 
+ *
+ *  Program and erase functions return as soon as the command is issued,
+ *  the busy wait happens at the start of the next operation. The caller
+ *  prepares the next page while the chip programs the previous one.
+ *  Busy polling keeps a single Read Status command running and clocks
+ *  status bytes until WIP clears, instead of one command per poll, up to
+ *  NOR_POLL_BUSY bytes. The bus is held in mode 0, MSB first, at NOR_CLOCK
+ *  and the settings of the other devices are restored on release.
+ *  spi_master_init() must have been called before nor_init().
+ *
+ *  @author Julien Delvaux <delvaux.ju@gmail.com>
+ */
+
+
+#ifndef NOR_H_
+#define NOR_H_
+
+#include "SPI.h"
+
+/************************************************************************/
+/* Constants and macros                                                 */
+/************************************************************************/
+
+/* Chip select pin, given as PORT letter, bit number. Defaults to SS */
+#ifndef NOR_CS
+	#if defined(__AVR_ATmega164P__) || defined(__AVR_ATmega324P__) || defined(__AVR_ATmega644P__) || \
+		defined(__AVR_ATmega1284P__)
+		#define NOR_CS		B, 4
+	#else
+		#define NOR_CS		B, 2
+	#endif
+#endif
+
+#ifndef NOR_CLOCK
+#define NOR_CLOCK			SPI_CLOCK_DIV2	/**< Fast read is specified well above F_CPU/2 */
+#endif
+
+#ifndef NOR_PAGE_SIZE
+#define NOR_PAGE_SIZE		256
+#endif
+
+#define NOR_SECTOR_SIZE		4096UL
+#define NOR_BLOCK_SIZE		65536UL
+
+#ifndef NOR_POLL_BUSY
+#define NOR_POLL_BUSY		2000000UL	/**< Status bytes clocked before giving up, 4s at 4MHz */
+#endif
+
+/* Return codes */
+#define NOR_OK				0
+#define NOR_ERROR_TIMEOUT	1	// chip stayed busy or is missing (MISO floating high)
+
+/************************************************************************/
+/* Functions prototype                                                  */
+/************************************************************************/
+
+/**
+   @brief   Configure the chip select pin and wake the chip up
+   @param   none
+   @return  none
+*/
+extern void nor_init(void);
+
+/**
+   @brief   Read the JEDEC identification
+   @param   id 3 bytes: manufacturer, memory type, capacity
+   @return  NOR_OK or NOR_ERROR_TIMEOUT
+*/
+extern uint8_t nor_read_id(uint8_t *id);
+
+/**
+   @brief   Tell if a program or erase is in progress, single status read
+   @param   none
+   @return  1 if busy, 0 if ready
+*/
+extern uint8_t nor_busy(void);
+
+/**
+   @brief   Wait for the end of a program or erase
+   
+   Gives up after NOR_POLL_BUSY status bytes, a chip erase may need
+   several calls.
+
+   @param   none
+   @return  NOR_OK or NOR_ERROR_TIMEOUT
+*/
+extern uint8_t nor_wait_ready(void);
+
+/**
+   @brief   Stream bytes with Fast Read (0x0B) into a buffer
+   @param   address first byte address
+   @param   data buffer receiving the bytes
+   @param   length number of bytes, not limited by pages
+   @return  NOR_OK or NOR_ERROR_TIMEOUT, the previous operation did not end
+*/
+extern uint8_t nor_read(uint32_t address, uint8_t *data, uint16_t length);
+
+/**
+   @brief   Program bytes, split at page boundaries
+   
+   Returns once the last page program is issued, without waiting for it.
+
+   @param   address first byte address
+   @param   data bytes to program
+   @param   length number of bytes
+   @return  NOR_OK or NOR_ERROR_TIMEOUT, the previous operation did not end
+*/
+extern uint8_t nor_program(uint32_t address, const uint8_t *data, uint16_t length);
+
+/**
+   @brief   Erase the 4KB sector containing the address, without waiting
+   @param   address any address inside the sector
+   @return  NOR_OK or NOR_ERROR_TIMEOUT
+*/
+extern uint8_t nor_erase_sector(uint32_t address);
+
+/**
+   @brief   Erase the 64KB block containing the address, without waiting
+   @param   address any address inside the block
+   @return  NOR_OK or NOR_ERROR_TIMEOUT
+*/
+extern uint8_t nor_erase_block(uint32_t address);
+
+/**
+   @brief   Erase the whole chip, without waiting
+   @param   none
+   @return  NOR_OK or NOR_ERROR_TIMEOUT
+*/
+extern uint8_t nor_erase_chip(void);
+
+#endif /* NOR_H_ */
@@ -0,0 +1,383 @@
+/*************************************************************************
+	
+	SD/MMC card driver by Julien Delvaux
+
+*************************************************************************/
+
+#include "SD.h"
+
+#if defined (SPI_MASTER_ENABLED)
+
+/************************************************************************/
+/* Constants and macros                                                 */
+/************************************************************************/
+
+/* Commands, ACMDx have bit 7 set and are prefixed by CMD55 */
+#define SD_CMD0		0		// GO_IDLE_STATE
+#define SD_CMD1		1		// SEND_OP_COND (MMC)
+#define SD_CMD8		8		// SEND_IF_COND
+#define SD_CMD12	12		// STOP_TRANSMISSION
+#define SD_CMD16	16		// SET_BLOCKLEN
+#define SD_CMD17	17		// READ_SINGLE_BLOCK
+#define SD_CMD18	18		// READ_MULTIPLE_BLOCK
+#define SD_CMD24	24		// WRITE_BLOCK
+#define SD_CMD25	25		// WRITE_MULTIPLE_BLOCK
+#define SD_CMD55	55		// APP_CMD
+#define SD_CMD58	58		// READ_OCR
+#define SD_ACMD41	(0x80|41)	// SD_SEND_OP_COND
+
+#define SD_R1_READY			0x00
+#define SD_R1_IDLE			0x01
+
+#define SD_TOKEN_START		0xFE	// single block read/write, multiple block read
+#define SD_TOKEN_MULTI		0xFC	// multiple block write
+#define SD_TOKEN_STOP		0xFD	// end of multiple block write
+#define SD_DATA_ACCEPTED	0x05
+
+/* Timeouts in bytes clocked, sized for SD_CLOCK_FAST up to 4MHz */
+#define SD_POLL_RESPONSE	8		// R1 comes within 8 bytes
+#define SD_POLL_TOKEN		50000UL	// read access time, 100ms
+#define SD_POLL_BUSY		150000UL	// write busy, 250ms
+#define SD_POLL_INIT		2000	// ACMD41 retries, 1s at SD_CLOCK_INIT
+
+/************************************************************************/
+/* Global variable                                                      */
+/************************************************************************/
+
+static uint8_t SD_Type = SD_TYPE_NONE;
+
+/*************************************************************************
+Function: sd_begin()
+Purpose:  take the bus at the transfer clock and select the card
+Input:    none
+Returns:  none
+**************************************************************************/
+static void sd_begin(void){
+	
+	spi_master_acquire_settings(SPI_MODE0, SD_CLOCK_FAST, SPI_MSBFIRST);
+	SPI_IO_LOW(SD_CS);
+}
+
+/*************************************************************************
+Function: sd_end()
+Purpose:  deselect the card and give the bus back
+          One more byte is clocked so the card releases MISO
+Input:    none
+Returns:  none
+**************************************************************************/
+static void sd_end(void){
+	
+	SPI_IO_HIGH(SD_CS);
+	spi_master_exchange(0xFF);
+	spi_master_release();
+}
+
+/*************************************************************************
+Function: sd_wait_ready()
+Purpose:  wait until the card stops holding MISO low
+Input:    maximum number of bytes to clock
+Returns:  1 if ready, 0 on timeout
+**************************************************************************/
+static uint8_t sd_wait_ready(uint32_t polls){
+	
+	while (polls--) {
+		if (spi_master_exchange(0xFF) == 0xFF) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*************************************************************************
+Function: sd_command()
+Purpose:  send a command frame and read the R1 response
+Input:    command SD_CMDx or SD_ACMDx, 32-bit argument
+Returns:  R1, 0xFF if the card did not answer
+**************************************************************************/
+static uint8_t sd_command(uint8_t command, uint32_t argument){
+	
+	uint8_t frame[6];
+	uint8_t response;
+	uint8_t polls;
+	
+	if (command & 0x80) {
+		command &= 0x7F;
+		response = sd_command(SD_CMD55, 0);
+		if (response > SD_R1_IDLE) {
+			return response;
+		}
+	}
+	
+	// Cards may hold MISO low until reset, do not wait on CMD0
+	if (command != SD_CMD0) {
+		sd_wait_ready(SD_POLL_BUSY);
+	}
+	
+	frame[0] = 0x40 | command;
+	frame[1] = argument >> 24;
+	frame[2] = argument >> 16;
+	frame[3] = argument >> 8;
+	frame[4] = argument;
+	// CRC is only checked for CMD0 and CMD8 in SPI mode
+	frame[5] = (command == SD_CMD0) ? 0x95 : (command == SD_CMD8) ? 0x87 : 0x01;
+	spi_master_write_block(frame, sizeof(frame));
+	
+	if (command == SD_CMD12) {
+		spi_master_exchange(0xFF); // stuff byte
+	}
+	
+	polls = SD_POLL_RESPONSE;
+	do {
+		response = spi_master_exchange(0xFF);
+	} while ((response & 0x80) && --polls);
+	
+	return response;
+}
+
+/*************************************************************************
+Function: sd_receive_block()
+Purpose:  wait for the start token and read one data block
+Input:    buffer of SD_BLOCK_SIZE bytes
+Returns:  SD_OK or SD_ERROR_x
+**************************************************************************/
+static uint8_t sd_receive_block(uint8_t *data){
+	
+	uint32_t polls = SD_POLL_TOKEN;
+	uint8_t token;
+	
+	do {
+		token = spi_master_exchange(0xFF);
+	} while (token == 0xFF && --polls);
+	
+	if (token == 0xFF) {
+		return SD_ERROR_TIMEOUT;
+	}
+	if (token != SD_TOKEN_START) {
+		return SD_ERROR_DATA;
+	}
+	spi_master_read_block(data, SD_BLOCK_SIZE, 0xFF);
+	spi_master_exchange(0xFF); // CRC
+	spi_master_exchange(0xFF);
+	
+	return SD_OK;
+}
+
+/*************************************************************************
+Function: sd_send_block()
+Purpose:  send one data block and wait for the card to program it
+Input:    SD_BLOCK_SIZE bytes, start token
+Returns:  SD_OK or SD_ERROR_x
+**************************************************************************/
+static uint8_t sd_send_block(const uint8_t *data, uint8_t token){
+	
+	spi_master_exchange(0xFF);
+	spi_master_exchange(token);
+	spi_master_write_block(data, SD_BLOCK_SIZE);
+	spi_master_exchange(0xFF); // CRC, not checked
+	spi_master_exchange(0xFF);
+	
+	if ((spi_master_exchange(0xFF) & 0x1F) != SD_DATA_ACCEPTED) {
+		return SD_ERROR_DATA;
+	}
+	if (!sd_wait_ready(SD_POLL_BUSY)) {
+		return SD_ERROR_TIMEOUT;
+	}
+	return SD_OK;
+}
+
+/*************************************************************************
+Function: sd_address()
+Purpose:  convert a block number to the command argument
+Input:    block number
+Returns:  block number for SDHC, byte address otherwise
+**************************************************************************/
+static uint32_t sd_address(uint32_t block){
+	return (SD_Type == SD_TYPE_SDHC) ? block : (block << 9);
+}
+
+/*************************************************************************
+Function: sd_init()
+Purpose:  Initialize the card and switch to the transfer clock
+Input:    none
+Returns:  SD_OK or SD_ERROR_x
+**************************************************************************/
+uint8_t sd_init(void){
+	
+	uint8_t response[4];
+	uint8_t command;
+	uint8_t type = SD_TYPE_NONE;
+	uint16_t retry;
+	uint8_t i;
+	
+	SD_Type = SD_TYPE_NONE;
+	
+	spi_master_acquire_settings(SPI_MODE0, SD_CLOCK_INIT, SPI_MSBFIRST);
+	
+	// At least 74 clocks with the card deselected
+	SPI_IO_HIGH(SD_CS);
+	SPI_IO_OUTPUT(SD_CS);
+	for (i=0; i<10; i++) {
+		spi_master_exchange(0xFF);
+	}
+	
+	SPI_IO_LOW(SD_CS);
+	if (sd_command(SD_CMD0, 0) == SD_R1_IDLE) {
+		
+		if (sd_command(SD_CMD8, 0x1AA) == SD_R1_IDLE) {
+			// SD v2, check the voltage range echo then wait with HCS set
+			spi_master_read_block(response, 4, 0xFF);
+			if (response[2] == 0x01 && response[3] == 0xAA) {
+				for (retry=SD_POLL_INIT; retry; retry--) {
+					if (sd_command(SD_ACMD41, 1UL<<30) == SD_R1_READY) {
+						break;
+					}
+				}
+				if (retry && sd_command(SD_CMD58, 0) == SD_R1_READY) {
+					spi_master_read_block(response, 4, 0xFF);
+					type = (response[0] & 0x40) ? SD_TYPE_SDHC : SD_TYPE_SD2;
+				}
+			}
+		} else {
+			// SD v1 or MMC
+			if (sd_command(SD_ACMD41, 0) <= SD_R1_IDLE) {
+				type = SD_TYPE_SD1;
+				command = SD_ACMD41;
+			} else {
+				type = SD_TYPE_MMC;
+				command = SD_CMD1;
+			}
+			for (retry=SD_POLL_INIT; retry; retry--) {
+				if (sd_command(command, 0) == SD_R1_READY) {
+					break;
+				}
+			}
+			if (!retry) {
+				type = SD_TYPE_NONE;
+			}
+		}
+		
+		// Byte addressed cards may not default to 512-byte blocks
+		if (type != SD_TYPE_NONE && type != SD_TYPE_SDHC) {
+			if (sd_command(SD_CMD16, SD_BLOCK_SIZE) != SD_R1_READY) {
+				type = SD_TYPE_NONE;
+			}
+		}
+	}
+	
+	SD_Type = type;
+	sd_end();
+	
+	return (type == SD_TYPE_NONE) ? SD_ERROR_INIT : SD_OK;
+}
+
+/*************************************************************************
+Function: sd_type()
+Purpose:  Type of the initialized card
+Input:    none
+Returns:  SD_TYPE_x
+**************************************************************************/
+uint8_t sd_type(void){
+	return SD_Type;
+}
+
+/*************************************************************************
+Function: sd_read_blocks()
+Purpose:  Read consecutive blocks, CMD17 for one block, CMD18 otherwise
+Input:    first block, buffer, number of blocks
+Returns:  SD_OK or SD_ERROR_x
+**************************************************************************/
+uint8_t sd_read_blocks(uint32_t block, uint8_t *data, uint16_t count){
+	
+	uint8_t status = SD_OK;
+	uint8_t multiple = (count > 1);
+	
+	if (SD_Type == SD_TYPE_NONE) {
+		return SD_ERROR_INIT;
+	}
+	if (count == 0) {
+		return SD_OK;
+	}
+	
+	sd_begin();
+	if (sd_command(multiple ? SD_CMD18 : SD_CMD17, sd_address(block)) != SD_R1_READY) {
+		status = SD_ERROR_COMMAND;
+	} else {
+		while (count--) {
+			status = sd_receive_block(data);
+			if (status != SD_OK) {
+				break;
+			}
+			data += SD_BLOCK_SIZE;
+		}
+		if (multiple) {
+			sd_command(SD_CMD12, 0);
+		}
+	}
+	sd_end();
+	
+	return status;
+}
+
+/*************************************************************************
+Function: sd_write_blocks()
+Purpose:  Write consecutive blocks, CMD24 for one block, CMD25 otherwise
+Input:    first block, data, number of blocks
+Returns:  SD_OK or SD_ERROR_x
+**************************************************************************/
+uint8_t sd_write_blocks(uint32_t block, const uint8_t *data, uint16_t count){
+	
+	uint8_t status = SD_OK;
+	uint8_t multiple = (count > 1);
+	
+	if (SD_Type == SD_TYPE_NONE) {
+		return SD_ERROR_INIT;
+	}
+	if (count == 0) {
+		return SD_OK;
+	}
+	
+	sd_begin();
+	if (sd_command(multiple ? SD_CMD25 : SD_CMD24, sd_address(block)) != SD_R1_READY) {
+		status = SD_ERROR_COMMAND;
+	} else {
+		while (count--) {
+			status = sd_send_block(data, multiple ? SD_TOKEN_MULTI : SD_TOKEN_START);
+			if (status != SD_OK) {
+				break;
+			}
+			data += SD_BLOCK_SIZE;
+		}
+		if (multiple) {
+			spi_master_exchange(SD_TOKEN_STOP);
+			spi_master_exchange(0xFF);
+			if (!sd_wait_ready(SD_POLL_BUSY) && status == SD_OK) {
+				status = SD_ERROR_TIMEOUT;
+			}
+		}
+	}
+	sd_end();
+	
+	return status;
+}
+
+/*************************************************************************
+Function: sd_read_block()
+Purpose:  Read one block
+Input:    block, buffer
+Returns:  SD_OK or SD_ERROR_x
+**************************************************************************/
+uint8_t sd_read_block(uint32_t block, uint8_t *data){
+	return sd_read_blocks(block, data, 1);
+}
+
+/*************************************************************************
+Function: sd_write_block()
+Purpose:  Write one block
+Input:    block, data
+Returns:  SD_OK or SD_ERROR_x
+**************************************************************************/
+uint8_t sd_write_block(uint32_t block, const uint8_t *data){
+	return sd_write_blocks(block, data, 1);
+}
+
+#endif
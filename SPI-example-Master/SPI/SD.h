@@ -0,0 +1,143 @@
+/************************************************************************
+Title:    SD/MMC card block driver over the SPI master
+Author:   Julien Delvaux
+Software: Atmel Studio 7
+Hardware: AVR 8-Bits, tested with ATmega1284P and ATmega88PA-PU
+License:  GNU General Public License 3
+Usage:    see Doxygen manual
+
+
+
+LICENSE:
+	Copyright (C) 2015 Julien Delvaux
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+    
+************************************************************************/
+
+/** 
+ *  @defgroup avr-spi-sd SD Library
+ *  @code #include <SD.h> @endcode
+ * 
+ *  @brief SD/MMC card block driver using the SPI master. 
+ *
+ *  Sectors are 512 bytes. Commands and data blocks use the polled path of
+ *  the SPI library, the bus is acquired for the duration of each call in
+ *  mode 0, MSB first, at SD_CLOCK_INIT during identification and
+ *  SD_CLOCK_FAST afterwards. The settings of the other devices are
+ *  restored when the bus is released.
+ *  spi_master_init() must have been called before sd_init().
+ *
+ *  @author Julien Delvaux <delvaux.ju@gmail.com>
+ */
+
+
+#ifndef SD_H_
+#define SD_H_
+
+#include "SPI.h"
+
+/************************************************************************/
+/* Constants and macros                                                 */
+/************************************************************************/
+
+/* Card select pin, given as PORT letter, bit number. Defaults to SS */
+#ifndef SD_CS
+	#if defined(__AVR_ATmega164P__) || defined(__AVR_ATmega324P__) || defined(__AVR_ATmega644P__) || \
+		defined(__AVR_ATmega1284P__)
+		#define SD_CS		B, 4
+	#else
+		#define SD_CS		B, 2
+	#endif
+#endif
+
+#ifndef SD_CLOCK_INIT
+	#if defined (F_CPU)
+	#define SD_CLOCK_INIT		SPI_CLOCK_FOR(400000UL)	/**< Identification clock, must stay below 400KHz */
+	#else
+	#define SD_CLOCK_INIT		SPI_CLOCK_DIV128	// F_CPU unknown here, the slowest clock is safe up to 51.2MHz
+	#endif
+#endif
+
+#ifndef SD_CLOCK_FAST
+#define SD_CLOCK_FAST		SPI_CLOCK_DIV2		/**< Transfer clock, up to 25MHz */
+#endif
+
+#define SD_BLOCK_SIZE		512
+
+/* Return codes */
+#define SD_OK				0
+#define SD_ERROR_TIMEOUT	1	// card did not answer or stayed busy
+#define SD_ERROR_COMMAND	2	// command rejected, R1 not 0x00
+#define SD_ERROR_DATA		3	// data token or data response error
+#define SD_ERROR_INIT		4	// card not initialized or not supported
+
+/* Card types */
+#define SD_TYPE_NONE		0
+#define SD_TYPE_MMC			1
+#define SD_TYPE_SD1			2
+#define SD_TYPE_SD2			3	// standard capacity, byte addressed
+#define SD_TYPE_SDHC		4	// high capacity, block addressed
+
+/************************************************************************/
+/* Functions prototype                                                  */
+/************************************************************************/
+
+/**
+   @brief   Initialize the card and switch the clock to SD_CLOCK_FAST
+   @param   none
+   @return  SD_OK or SD_ERROR_x
+*/
+extern uint8_t sd_init(void);
+
+/**
+   @brief   Type of the initialized card
+   @param   none
+   @return  SD_TYPE_x
+*/
+extern uint8_t sd_type(void);
+
+/**
+   @brief   Read one 512-byte block
+   @param   block number of the block
+   @param   data buffer of SD_BLOCK_SIZE bytes
+   @return  SD_OK or SD_ERROR_x
+*/
+extern uint8_t sd_read_block(uint32_t block, uint8_t *data);
+
+/**
+   @brief   Write one 512-byte block
+   @param   block number of the block
+   @param   data SD_BLOCK_SIZE bytes to write
+   @return  SD_OK or SD_ERROR_x
+*/
+extern uint8_t sd_write_block(uint32_t block, const uint8_t *data);
+
+/**
+   @brief   Read consecutive blocks with a single multiple block command
+   @param   block number of the first block
+   @param   data buffer of count * SD_BLOCK_SIZE bytes
+   @param   count number of blocks
+   @return  SD_OK or SD_ERROR_x
+*/
+extern uint8_t sd_read_blocks(uint32_t block, uint8_t *data, uint16_t count);
+
+/**
+   @brief   Write consecutive blocks with a single multiple block command
+   @param   block number of the first block
+   @param   data count * SD_BLOCK_SIZE bytes to write
+   @param   count number of blocks
+   @return  SD_OK or SD_ERROR_x
+*/
+extern uint8_t sd_write_blocks(uint32_t block, const uint8_t *data, uint16_t count);
+
+#endif /* SD_H_ */
@@ -21,7 +21,9 @@ LICENSE:
 	GNU General Public License for more details.
     
 ************************************************************************/
-#define F_CPU 8000000UL
+#ifndef F_CPU
+#define F_CPU 8000000UL	// also given in the project symbols, for the library files
+#endif
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
@@ -31,7 +33,7 @@ LICENSE:
 
 int main(void)
 {
-	spi_master_init(SPI_MODE0, SPI_CLOCK_DIV64);
+	spi_master_init(SPI_MODE0, SPI_CLOCK_FOR(125000UL));
 	sei();
 	
 	_delay_ms(25);
@@ -5,6 +5,8 @@
 *************************************************************************/
 
 #include "SPI.h"
+#include <string.h>
+#include <util/atomic.h>
 
 /************************************************************************/
 /* Constants and macros                                                 */
@@ -33,6 +35,14 @@
 	#define SPI_PIN_SCK		5		//SCK PIN
 	#define SPI_DDR			DDRB	//SPI on PORTB
 	#define SPI_PORT		PORTB	//SPI on PORTB
+	#define SPI_PIN			PINB	//SPI on PORTB
+	#define SPI_SS_PCMSK	PCMSK0	//SS pin change mask
+	#define SPI_SS_PCINT	PCINT2	//SS pin change bit
+	#define SPI_SS_PCIE		PCIE0	//SS pin change group
+	#define SPI_SS_vect		PCINT0_vect
+	#define SPI_BRIDGE_UDRE_vect	USART_UDRE_vect	//USART0 data register empty
+	#define SPI_BRIDGE_XCK_DDR		DDRD	//XCK0 for the USART in SPI mode
+	#define SPI_BRIDGE_XCK_PIN		4
 
 #elif defined(__AVR_ATmega164P__) || defined(__AVR_ATmega324P__) || defined(__AVR_ATmega644P__) || \
 	  defined(__AVR_ATmega1284P__)
@@ -42,177 +52,1387 @@
 	#define SPI_PIN_SCK		7		//SCK PIN
 	#define SPI_DDR			DDRB	//SPI on PORTB
 	#define SPI_PORT		PORTB	//SPI on PORTB
+	#define SPI_PIN			PINB	//SPI on PORTB
+	#define SPI_SS_PCMSK	PCMSK1	//SS pin change mask
+	#define SPI_SS_PCINT	PCINT12	//SS pin change bit
+	#define SPI_SS_PCIE		PCIE1	//SS pin change group
+	#define SPI_SS_vect		PCINT1_vect
+	#define SPI_BRIDGE_UDRE_vect	USART0_UDRE_vect	//USART0 data register empty
+	#define SPI_BRIDGE_XCK_DDR		DDRB	//XCK0 for the USART in SPI mode
+	#define SPI_BRIDGE_XCK_PIN		0
 #else
 	#error "no SPI definition for MCU available"
 #endif
 
+#if ( SPI_RX_BUFFER_SIZE > 32768 ) || ( SPI_TX_BUFFER_SIZE > 32768 )
+	#error RX and TX buffers are limited to 32768 bytes
+#endif
+
+/* Ring indexes are 8-bit up to 256 bytes, 16-bit above. A 16-bit index
+   shared with the ISR must be accessed with interrupts disabled, the TX
+   indexes are only touched under the reservation lock already. */
+#if ( SPI_RX_BUFFER_SIZE > 256 )
+	typedef uint16_t spi_rx_index_t;
+	#define SPI_RX_ATOMIC	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#else
+	typedef uint8_t spi_rx_index_t;
+	#define SPI_RX_ATOMIC
+#endif
+
+#if ( SPI_TX_BUFFER_SIZE > 256 )
+	typedef uint16_t spi_tx_index_t;
+#else
+	typedef uint8_t spi_tx_index_t;
+#endif
+
+#define SPI_TRACE_MASK ( SPI_TRACE_SIZE - 1)
+
+#if ( SPI_TRACE_SIZE & SPI_TRACE_MASK ) || ( SPI_TRACE_SIZE > 256 )
+	#error Trace size is not a power of 2 up to 256
+#endif
+
+#if defined (SPI_MINIMAL_ENABLED) && ( defined (SPI_SG_ENABLED) || defined (SPI_REGMAP_ENABLED) || \
+	defined (SPI_EVENTS_ENABLED) || defined (SPI_LATENCY_ENABLED) || defined (SPI_TRACE_ENABLED) || \
+	defined (SPI_READAHEAD_ENABLED) || defined (SPI_PROFILE_ENABLED) || defined (SPI_BRIDGE_ENABLED) || \
+	defined (SPI_BATCH_ENABLED) || defined (SPI_TIMEOUT_ENABLED) )
+	#error The minimal configuration has no ringbuffers, disable the options built on them
+#endif
+
+#if defined (SPI_BATCH_ENABLED) && ( ( SPI_BATCH_WINDOW < 1 ) || ( SPI_BATCH_THRESHOLD >= SPI_TX_BUFFER_SIZE ) )
+	#error Batching needs SPI_BATCH_WINDOW >= 1 and SPI_BATCH_THRESHOLD < SPI_TX_BUFFER_SIZE
+#endif
+
+#if defined (SPI_BRIDGE_ENABLED) && ( SPI_BRIDGE_HIGH_WATER >= SPI_RX_BUFFER_SIZE )
+	#error SPI_BRIDGE_HIGH_WATER must be below SPI_RX_BUFFER_SIZE
+#endif
+
+#if defined (SPI_READAHEAD_ENABLED) && \
+	( ( SPI_READAHEAD_LOW_WATER >= SPI_READAHEAD_HIGH_WATER ) || ( SPI_READAHEAD_HIGH_WATER >= SPI_RX_BUFFER_SIZE ) )
+	#error Read-ahead needs LOW_WATER < HIGH_WATER < SPI_RX_BUFFER_SIZE
+#endif
+
+#if ( SPI_LATENCY_BUCKETS < 2 )
+	#error Latency histograms need at least 2 buckets
+#endif
+
+/* SPCR bits given by the settings */
+#define SPI_SPCR_MODE		((1<<CPOL)|(1<<CPHA))
+#define SPI_SPCR_SETTINGS	((1<<DORD)|SPI_SPCR_MODE|(1<<SPR1)|(1<<SPR0))
+#define SPI_SPCR_OF(mode, clock, bitorder)	(((mode) & SPI_SPCR_MODE)|((bitorder) & (1<<DORD))|(((clock) & 0x03)<<SPR0))
+
 /************************************************************************/
 /* Global variable                                                      */
 /************************************************************************/
 
+#if defined (SPI_MINIMAL_ENABLED)
+/* No ringbuffers, transfers go straight from and into the caller buffers.
+   The whole state fits in one byte, SPI_CTS included. */
+static volatile struct {
+	uint8_t cts : 1;	// SPI_ACTIVE or SPI_INACTIVE (master)
+	uint8_t tx : 1;		// SPI_DirectTx holds the bytes to send
+	uint8_t rx : 1;		// SPI_DirectRx receives the bytes
+} SPI_State;
+static const uint8_t *SPI_DirectTx;
+static uint8_t *SPI_DirectRx;
+static volatile uint16_t SPI_DirectLeft;	// Bytes left to transfer
+
+#else
 static volatile uint8_t SPI_TxBuf[SPI_TX_BUFFER_SIZE];
 static volatile uint8_t SPI_RxBuf[SPI_RX_BUFFER_SIZE];
-static volatile uint8_t SPI_TxHead;
-static volatile uint8_t SPI_TxTail;
-static volatile uint8_t SPI_RxHead;
-static volatile uint8_t SPI_RxTail;
+static volatile spi_tx_index_t SPI_TxHead;		// Last byte committed, read by the ISR
+static volatile spi_tx_index_t SPI_TxTail;
+static volatile spi_tx_index_t SPI_TxReserve;	// Last byte reserved by a producer
+static volatile uint8_t SPI_TxPending;			// Reservations not yet committed
+static volatile spi_rx_index_t SPI_RxHead;
+static volatile spi_rx_index_t SPI_RxTail;
+#endif
+
+#if defined (SPI_MASTER_ENABLED) && defined(SPI_SLAVE_ENABLED)
+	#error The multimaster mode of SPI is not yet implement. Do not hesitate to implement it, then submit a pull request ! Thx
+#elif defined (SPI_MINIMAL_ENABLED)
+	#define SPI_CTS			SPI_State.cts
+#elif defined(SPI_MASTER_ENABLED)
+	static volatile uint8_t SPI_CTS;
+	static volatile uint16_t SPI_bytesRequest; // Number of bytes request
+	static volatile spi_ticket SPI_TxnStarted; // Transactions started (SS put low)
+	static volatile spi_ticket SPI_TxnDone; // Transactions done (SS put high)
+	#if defined (SPI_BATCH_ENABLED)
+	static volatile uint8_t SPI_BatchAge; // spi_master_tick() left before the held bytes start, 0 if none
+	#endif
+	#if defined (SPI_TIMEOUT_ENABLED)
+	static volatile uint8_t SPI_TimeoutAge;		// spi_master_tick() calls without a byte completed
+	static volatile uint16_t SPI_Timeouts;		// Transactions aborted on timeout
+	static uint8_t SPI_TimeoutTicks = SPI_TIMEOUT_TICKS;
+	#define SPI_TIMEOUT_PROGRESS()	(SPI_TimeoutAge = 0)
+	#else
+	#define SPI_TIMEOUT_PROGRESS()
+	#endif
+	#if defined (SPI_READAHEAD_ENABLED)
+	static volatile uint8_t SPI_Stream;
+	#define SPI_STREAM_OFF		0
+	#define SPI_STREAM_RUNNING	1	// dummy bytes clocked while the receive buffer has room
+	#define SPI_STREAM_PAUSED	2	// receive buffer full, SS kept low
+	#endif
+	#if defined (SPI_SG_ENABLED)
+	static volatile uint8_t SPI_SgActive;						// Segment list in progress
+	static const struct spi_segment * volatile SPI_SgSegment;	// Next segment to load
+	static volatile uint8_t SPI_SgCount;						// Segments not loaded yet
+	static const uint8_t * volatile SPI_SgData;					// Next byte of the current segment
+	static volatile uint16_t SPI_SgLeft;						// Bytes left in the current segment
+	static volatile uint8_t SPI_SgFlags;						// Flags of the current segment
+	static uint8_t * volatile SPI_SgRxData;						// Destination of the byte in flight
+	#endif
+#elif defined(SPI_SLAVE_ENABLED)
+	static volatile uint8_t SPI_SPDR;
+	#define SPI_SPDR_EMPTY	0
+	#define SPI_SPDR_FULL	1
+	#if defined (SPI_BRIDGE_ENABLED)
+	static volatile uint8_t SPI_Bridge; // Receive buffer drained by the USART
+	#endif
+	#if defined (SPI_REGMAP_ENABLED)
+	static const struct spi_register * volatile SPI_RegMap;	// Register map, 0 when not used
+	static volatile uint8_t SPI_RegCount;
+	static const struct spi_register *SPI_Reg;		// Register at the current address, 0 if unmapped
+	static uint8_t SPI_RegAddress;					// Current address
+	static uint8_t SPI_RegOffset;					// Current byte inside SPI_Reg
+	static uint8_t SPI_RegState;
+	#define SPI_REG_COMMAND	0	// next byte is the command
+	#define SPI_REG_READ	1	// master reads from the current address
+	#define SPI_REG_WRITE	2	// master writes to the current address
+	#define SPI_REG_WRITTEN	3	// SPI_Reg has been written, callback pending
+	#endif
+#endif
+
+#if defined (SPI_LATENCY_ENABLED) || defined (SPI_TRACE_ENABLED) || defined (SPI_PROFILE_ENABLED)
+/*************************************************************************
+Function: spi_timer_now()
+Purpose:  read the free-running timer, the 16-bit access goes through the
+          shared TEMP register so it must not be interrupted
+Returns:  timer value
+**************************************************************************/
+static inline uint16_t spi_timer_now(void){
+	uint16_t now;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		now = SPI_LATENCY_TIMER;
+	}
+	return now;
+}
+#endif
+
+#if !defined (SPI_MINIMAL_ENABLED)
+static volatile uint16_t SPI_RxLost; // Bytes dropped on receive buffer overflow
+static volatile uint16_t SPI_TxRejected; // Bytes refused, transmit buffer full
+#endif
+
+#if defined (SPI_TRACE_ENABLED)
+	static struct spi_trace_entry SPI_Trace[SPI_TRACE_SIZE];
+	static volatile uint8_t SPI_TraceHead;
+	static volatile uint8_t SPI_TraceTail;
+	static volatile uint8_t SPI_TraceSent; // Last byte written to SPDR
+
+/*************************************************************************
+Function: spi_trace_record()
+Purpose:  record the byte just exchanged, the oldest entry is overwritten
+          when the trace is full
+Input:    none
+Returns:  none
+**************************************************************************/
+static inline void spi_trace_record(void){
+	
+	struct spi_trace_entry *entry;
+	uint8_t tmphead = (SPI_TraceHead + 1) & SPI_TRACE_MASK;
+	
+	if (tmphead == SPI_TraceTail) {
+		SPI_TraceTail = (SPI_TraceTail + 1) & SPI_TRACE_MASK;
+	}
+	entry = &SPI_Trace[tmphead];
+	entry->time = spi_timer_now();
+	entry->sent = SPI_TraceSent;
+	entry->received = SPDR;
+	entry->flags = 0;
+	SPI_TraceHead = tmphead;
+}
+
+	#define SPI_SEND(data)			SPDR = SPI_TraceSent = (data)
+	#define SPI_TRACE_RECORD()		spi_trace_record()
+	#define SPI_TRACE_SS_HIGH()		SPI_Trace[SPI_TraceHead].flags |= SPI_TRACE_END
+#else
+	#define SPI_SEND(data)			SPDR = (data)
+	#define SPI_TRACE_RECORD()
+	#define SPI_TRACE_SS_HIGH()
+#endif
+
+#if defined (SPI_EVENTS_ENABLED)
+	static spi_event_callback SPI_EventCallback[SPI_EVENT_COUNT];
+	static volatile uint8_t SPI_EventDeferred;		// Events queued for spi_events_run()
+	static volatile uint8_t SPI_EventPending;		// Deferred events raised, not run yet
+	static volatile uint16_t SPI_EventThreshold;	// Bytes in receive buffer raising SPI_EVENT_RX_THRESHOLD
+
+/*************************************************************************
+Function: spi_event_raise()
+Purpose:  run the callback of an event now or queue it for the main loop
+Input:    event SPI_EVENT_x
+Returns:  none
+**************************************************************************/
+static void spi_event_raise(uint8_t event){
+	
+	uint8_t index=0;
+	
+	if (SPI_EventDeferred & event) {
+		SPI_EventPending |= event;
+		return;
+	}
+	while (!(event & (1<<index))) {
+		index++;
+	}
+	if (SPI_EventCallback[index]) {
+		SPI_EventCallback[index](event);
+	}
+}
+
+	#define SPI_EVENT(event)		spi_event_raise(event)
+	// raised once, when the receive buffer fills up to the threshold
+	#define SPI_EVENT_RX(head)		do { if ( (((head) - SPI_RxTail) & SPI_RX_BUFFER_MASK) == SPI_EventThreshold ) spi_event_raise(SPI_EVENT_RX_THRESHOLD); } while (0)
+#else
+	#define SPI_EVENT(event)
+	#define SPI_EVENT_RX(head)
+#endif
+
+#if defined (SPI_LATENCY_ENABLED)
+	static struct spi_latency_stats SPI_LatencyStats;
+	static volatile uint16_t SPI_RxStamp[SPI_RX_BUFFER_SIZE]; // Time each byte entered the receive buffer
+	static volatile uint16_t SPI_TxnStamp; // Time SS has been put low
+
+/*************************************************************************
+Function: spi_latency_record()
+Purpose:  add one latency to a histogram
+Input:    histogram to update, worst value to update, latency in ticks
+Returns:  none
+**************************************************************************/
+static void spi_latency_record(uint16_t *histogram, uint16_t *max, uint16_t latency){
+	uint8_t bucket=0;
+	uint16_t scaled = latency >> SPI_LATENCY_SHIFT;
+	
+	while (scaled && bucket < (SPI_LATENCY_BUCKETS - 1)) {
+		scaled >>= 1;
+		bucket++;
+	}
+	if (histogram[bucket] != 0xFFFF) {
+		histogram[bucket]++;
+	}
+	if (latency > *max) {
+		*max = latency;
+	}
+}
+
+	#define SPI_LATENCY_TXN_START()	SPI_TxnStamp = spi_timer_now()
+	#define SPI_LATENCY_TXN_END()	spi_latency_record(SPI_LatencyStats.transaction, &SPI_LatencyStats.transaction_max, spi_timer_now() - SPI_TxnStamp)
+	#define SPI_LATENCY_RX_PUSH(i)	SPI_RxStamp[i] = spi_timer_now()
+	#define SPI_LATENCY_RX_POP(i)	spi_latency_record(SPI_LatencyStats.rx_queue, &SPI_LatencyStats.rx_queue_max, spi_timer_now() - SPI_RxStamp[i])
+#else
+	#define SPI_LATENCY_TXN_START()
+	#define SPI_LATENCY_TXN_END()
+	#define SPI_LATENCY_RX_PUSH(i)
+	#define SPI_LATENCY_RX_POP(i)
+#endif
+
+#if defined (SPI_MASTER_ENABLED) && defined (SPI_PROFILE_ENABLED)
+	static struct spi_profile_stats SPI_ProfileStats;
+	static volatile uint8_t SPI_ProfileSlave;	// Slave given to spi_profile_slave()
+	static volatile uint8_t SPI_ProfileCurrent;	// Slave of the running transaction
+	static volatile uint8_t SPI_ProfileIdle;	// SPI_ProfileStamp is the end of the last transaction
+	static volatile uint16_t SPI_ProfileStamp;	// Last time SS changed
+
+/*************************************************************************
+Function: spi_profile_start()
+Purpose:  account the idle gap before a transaction
+Input:    none
+Returns:  none
+**************************************************************************/
+static inline void spi_profile_start(void){
+	uint16_t now = spi_timer_now();
+	uint16_t gap = now - SPI_ProfileStamp;
+	
+	if (SPI_ProfileIdle) {
+		SPI_ProfileStats.idle += gap;
+		SPI_ProfileStats.gaps++;
+		if (gap > SPI_ProfileStats.idle_max) {
+			SPI_ProfileStats.idle_max = gap;
+		}
+	}
+	SPI_ProfileCurrent = SPI_ProfileSlave;
+	SPI_ProfileStats.slave[SPI_ProfileCurrent].transactions++;
+	SPI_ProfileStamp = now;
+}
+
+/*************************************************************************
+Function: spi_profile_end()
+Purpose:  account the bus-busy time of the transaction
+Input:    none
+Returns:  none
+**************************************************************************/
+static inline void spi_profile_end(void){
+	uint16_t now = spi_timer_now();
+	
+	SPI_ProfileStats.slave[SPI_ProfileCurrent].busy += (uint16_t)(now - SPI_ProfileStamp);
+	SPI_ProfileStamp = now;
+	SPI_ProfileIdle = 1;
+}
+
+	#define SPI_PROFILE_TXN_START()	spi_profile_start()
+	#define SPI_PROFILE_TXN_END()	spi_profile_end()
+	#define SPI_PROFILE_BYTES(n)	SPI_ProfileStats.slave[SPI_ProfileCurrent].bytes += (n)
+#else
+	#define SPI_PROFILE_TXN_START()
+	#define SPI_PROFILE_TXN_END()
+	#define SPI_PROFILE_BYTES(n)
+#endif
+
+#if defined (SPI_MASTER_ENABLED) && !defined (SPI_MINIMAL_ENABLED)
+/*************************************************************************
+Function: spi_master_stop()
+Purpose:  end the transaction, put SS high
+Input:    none
+Returns:  none
+**************************************************************************/
+static inline void spi_master_stop(void){
+	
+	SPI_PORT|= (1<<SPI_PIN_SS);
+	SPI_CTS = SPI_INACTIVE;
+	SPI_LATENCY_TXN_END();
+	SPI_PROFILE_TXN_END();
+	SPI_TxnDone++;
+#if defined (SPI_TIMEOUT_ENABLED)
+	SPI_TimeoutAge = 0;
+#endif
+	SPI_TRACE_SS_HIGH();
+	SPI_EVENT(SPI_EVENT_COMPLETE);
+}
+
+/*************************************************************************
+Function: spi_master_start()
+Purpose:  start a transaction with the next queued byte, 0x00 if none,
+          SPI_CTS must be inactive and interrupts disabled
+Input:    none
+Returns:  1 if 0x00 has been sent, 0 if a queued byte
+**************************************************************************/
+static inline uint8_t spi_master_start(void){
+	
+	uint16_t tmptail;
+	
+	SPI_CTS=SPI_ACTIVE;
+	SPI_LATENCY_TXN_START();
+	SPI_PROFILE_TXN_START();
+	SPI_TxnStarted++;
+	SPI_PORT&= ~(1<<SPI_PIN_SS); // Pull-down the line
+#if defined (SPI_BATCH_ENABLED)
+	SPI_BatchAge = 0;
+#endif
+	
+	if ( SPI_TxHead != SPI_TxTail ) {
+		tmptail = (SPI_TxTail + 1) & SPI_TX_BUFFER_MASK;
+		SPI_TxTail = tmptail;
+		SPI_SEND(SPI_TxBuf[tmptail]); /* start transmission */
+		if ( SPI_TxHead == tmptail ) {
+			SPI_EVENT(SPI_EVENT_TX_DRAINED);
+		}
+		return 0;
+	}
+	SPI_SEND(0x00); /* start transmission */
+	return 1;
+}
+
+/* Bus held by spi_master_acquire(): bytes queued meanwhile go with the
+   transaction started by spi_master_release() */
+#define SPI_POLLED_SESSION()	(SPI_CTS==SPI_ACTIVE && !(SPCR & (1<<SPIE)))
+
+/*************************************************************************
+Function: spi_master_next()
+Purpose:  send the next byte of the transaction in flight: queued byte,
+          byte read or read-ahead, ends the transaction when none is left
+Input:    none
+Returns:  none
+**************************************************************************/
+static inline void spi_master_next(void){
+	
+	uint16_t tmptail;
+	
+	if ( SPI_TxHead != SPI_TxTail) {
+		// calculate and store new buffer index 
+		tmptail = (SPI_TxTail + 1) & SPI_TX_BUFFER_MASK;
+		SPI_TxTail = tmptail;
+		// get one byte from buffer and write it to UART
+		SPI_SEND(SPI_TxBuf[tmptail]);  // start transmission 
+		if ( SPI_TxHead == tmptail ) {
+			SPI_EVENT(SPI_EVENT_TX_DRAINED);
+		}
+		} 
+	else if(SPI_bytesRequest>0){
+		SPI_bytesRequest--;
+		SPI_SEND(0x00);
+	}
+	#if defined (SPI_READAHEAD_ENABLED)
+	else if(SPI_Stream){
+		// keep reading ahead while the receive buffer has room, SS stays low
+		if ( ((SPI_RxHead - SPI_RxTail) & SPI_RX_BUFFER_MASK) < SPI_READAHEAD_HIGH_WATER ) {
+			SPI_SEND(0x00);
+		} else {
+			SPI_Stream = SPI_STREAM_PAUSED;
+		}
+	}
+	#endif
+	else {
+		// tx buffer empty, STOP the transmission
+		spi_master_stop();
+	}
+}
+
+#if defined (SPI_TIMEOUT_ENABLED)
+/*************************************************************************
+Function: spi_master_reset()
+Purpose:  abort the byte in flight and end the transaction,
+          interrupts disabled
+Input:    none
+Returns:  none
+**************************************************************************/
+static void spi_master_reset(void){
+	
+	uint8_t dump;
+	
+	// Disabling the SPI stops the shift register, SPIF is then cleared
+	SPCR &= ~(1<<SPE);
+	SPCR |= (1<<SPE);
+	dump = SPSR;
+	dump = SPDR;
+	(void)dump;
+	
+#if defined (SPI_SG_ENABLED)
+	SPI_SgActive = 0;
+#endif
+#if defined (SPI_READAHEAD_ENABLED)
+	SPI_Stream = SPI_STREAM_OFF;
+#endif
+	spi_master_stop();
+}
+#endif
+#endif
+
+#if defined (SPI_MASTER_ENABLED) && defined (SPI_SG_ENABLED)
+/*************************************************************************
+Function: spi_sg_next()
+Purpose:  start the next byte of the segment list
+Returns:  1 if a byte has been started, 0 at the end of the list
+**************************************************************************/
+static inline uint8_t spi_sg_next(void){
+	
+	const struct spi_segment *segment;
+	uint8_t data=0x00;
+	
+	while (SPI_SgLeft == 0) {
+		if (SPI_SgCount == 0) {
+			return 0;
+		}
+		segment = SPI_SgSegment;
+		SPI_SgSegment = segment + 1;
+		SPI_SgCount--;
+		SPI_SgData = segment->data;
+		SPI_SgLeft = segment->length;
+		SPI_SgFlags = segment->flags;
+	}
+	SPI_SgLeft--;
+	
+	SPI_SgRxData = (SPI_SgFlags & SPI_SEG_RX) ? (uint8_t *)SPI_SgData : 0;
+	if (SPI_SgFlags & SPI_SEG_TX) {
+		data = (SPI_SgFlags & SPI_SEG_PGM) ? pgm_read_byte(SPI_SgData) : *SPI_SgData;
+	}
+	SPI_SgData++;
+	SPI_SEND(data);
+	
+	return 1;
+}
+#endif
+
+#if defined (SPI_SLAVE_ENABLED) && defined (SPI_REGMAP_ENABLED)
+/*************************************************************************
+Function: spi_reg_seek()
+Purpose:  find the register holding the current address
+Input:    none
+Returns:  none
+**************************************************************************/
+static void spi_reg_seek(void){
+	
+	const struct spi_register *reg = SPI_RegMap;
+	uint8_t count = SPI_RegCount;
+	
+	SPI_Reg = 0;
+	while (count--) {
+		if ((uint8_t)(SPI_RegAddress - reg->address) < reg->size) {
+			SPI_Reg = reg;
+			SPI_RegOffset = SPI_RegAddress - reg->address;
+			return;
+		}
+		reg++;
+	}
+}
+
+/*************************************************************************
+Function: spi_reg_written()
+Purpose:  call the write callback of the register just left
+Input:    none
+Returns:  none
+**************************************************************************/
+static void spi_reg_written(void){
+	
+	if (SPI_RegState == SPI_REG_WRITTEN) {
+		SPI_RegState = SPI_REG_WRITE;
+		if (SPI_Reg->on_write) {
+			SPI_Reg->on_write(SPI_Reg->address);
+		}
+	}
+}
+
+/*************************************************************************
+Function: spi_reg_byte()
+Purpose:  handle the byte received in SPDR and load the answer
+Input:    none
+Returns:  none
+**************************************************************************/
+static void spi_reg_byte(void){
+	
+	uint8_t data = SPDR;
+	
+	if (SPI_RegState == SPI_REG_COMMAND) {
+		// bit 7 set for a read, address on bits 6-0
+		SPI_RegAddress = data & 0x7F;
+		SPI_RegState = (data & 0x80) ? SPI_REG_READ : SPI_REG_WRITE;
+		spi_reg_seek();
+	}
+	else {
+		if (SPI_RegState != SPI_REG_READ && SPI_Reg && !(SPI_Reg->flags & SPI_REG_READONLY)) {
+			SPI_Reg->data[SPI_RegOffset] = data;
+			SPI_RegState = SPI_REG_WRITTEN;
+		}
+		// auto-increment, move to the next register at the end of this one
+		SPI_RegAddress = (SPI_RegAddress + 1) & 0x7F;
+		if (!SPI_Reg || ++SPI_RegOffset >= SPI_Reg->size) {
+			if (SPI_Reg) {
+				spi_reg_written();
+			}
+			spi_reg_seek();
+		}
+	}
+	// byte the master clocks out next
+	SPI_SEND((SPI_RegState == SPI_REG_READ && SPI_Reg) ? SPI_Reg->data[SPI_RegOffset] : 0x00);
+}
+
+ISR(SPI_SS_vect)
+/*************************************************************************
+Function: SS pin change interrupt
+Purpose:  end of a register map frame when SS goes high
+**************************************************************************/
+{
+	if (SPI_PIN & (1<<SPI_PIN_SS)) {
+		if (SPI_RegMap) {
+			// The pin change vector comes before SPI_STC_vect: when SS rises
+			// right after the last byte, that byte is still waiting in SPDR.
+			// Handle it here (reading SPSR then SPDR clears SPIF) so it
+			// belongs to this frame and not to the command of the next one.
+			if (SPSR & (1<<SPIF)) {
+				spi_reg_byte();
+			}
+			spi_reg_written();
+		}
+		SPI_RegState = SPI_REG_COMMAND;
+		SPI_SEND(0x00);
+	}
+}
+#endif
+
+#if defined (SPI_MINIMAL_ENABLED)
+ISR(SPI_STC_vect)
+/*************************************************************************
+Function: SPI interrupt, minimal configuration
+Purpose:  move one byte between SPDR and the caller buffers
+**************************************************************************/
+{
+	/* SPI MASTER */
+#if defined (SPI_MASTER_ENABLED)
+	
+	if (SPI_State.rx) {
+		*SPI_DirectRx++ = SPDR;
+	}
+	if (SPI_DirectLeft) {
+		SPI_DirectLeft--;
+		SPDR = SPI_State.tx ? *SPI_DirectTx++ : 0x00;
+	}
+	else {
+		SPI_PORT|= (1<<SPI_PIN_SS);
+		SPI_CTS = SPI_INACTIVE;
+	}
+	
+	/* SPI Slave */
+#elif defined(SPI_SLAVE_ENABLED)
+	
+	if (SPI_DirectLeft) {
+		if (SPI_State.rx) {
+			*SPI_DirectRx++ = SPDR;
+		}
+		SPI_DirectLeft--;
+		SPDR = (SPI_DirectLeft && SPI_State.tx) ? *SPI_DirectTx++ : 0x00;
+	}
+	
+#endif
+}
+#else
+ISR(SPI_STC_vect)
+/*************************************************************************
+Function: SPI interrupt
+Purpose:  called when the SS pin has been put low
+**************************************************************************/
+{
+	uint16_t tmphead=0;
+	
+	SPI_TRACE_RECORD();
+	
+	/* SPI MASTER */
+#if defined (SPI_MASTER_ENABLED)
+	
+	SPI_PROFILE_BYTES(1);
+	SPI_TIMEOUT_PROGRESS();
+	
+	#if defined (SPI_SG_ENABLED)
+	// Segment list bypasses the ringbuffers
+	if (SPI_SgActive) {
+		if (SPI_SgRxData) {
+			*SPI_SgRxData = SPDR;
+		}
+		if (!spi_sg_next()) {
+			// bytes queued meanwhile follow in the same SS assertion
+			SPI_SgActive = 0;
+			spi_master_next();
+		}
+		return;
+	}
+	#endif
+	
+	//RECEIVE
+	// calculate buffer index 
+	tmphead = ( SPI_RxHead + 1) & SPI_RX_BUFFER_MASK;
+	if ( tmphead == SPI_RxTail ) {
+		// error: receive buffer overflow
+		SPI_RxLost++;
+		SPI_EVENT(SPI_EVENT_ERROR);
+				
+		} else {
+		// store new index
+		SPI_RxHead = tmphead;
+		// store received data in buffer
+		SPI_RxBuf[tmphead] = SPDR;
+		SPI_LATENCY_RX_PUSH(tmphead);
+		SPI_EVENT_RX(tmphead);
+	}
+
+	// SEND
+	spi_master_next();
+
+	/* SPI Slave */
+#elif defined(SPI_SLAVE_ENABLED)
+	uint16_t tmptail=0;
+	
+	#if defined (SPI_REGMAP_ENABLED)
+	// Register map answers without the ringbuffers
+	if (SPI_RegMap) {
+		spi_reg_byte();
+		return;
+	}
+	#endif
+		
+	//RECEIVE
+	// calculate buffer index
+	tmphead = ( SPI_RxHead + 1) & SPI_RX_BUFFER_MASK;
+	if ( tmphead == SPI_RxTail ) {
+		// error: receive buffer overflow
+		SPI_RxLost++;
+		SPI_EVENT(SPI_EVENT_ERROR);
+					
+		} else {
+		// store new index
+		SPI_RxHead = tmphead;
+		// store received data in buffer
+		SPI_RxBuf[tmphead] = SPDR;
+		SPI_LATENCY_RX_PUSH(tmphead);
+		SPI_EVENT_RX(tmphead);
+		#if defined (SPI_BRIDGE_ENABLED)
+		if (SPI_Bridge) {
+			UCSR0B |= (1<<UDRIE0); // the USART takes the byte as soon as it is free
+		}
+		#endif
+	}
+
+	// SEND
+	if ( SPI_TxHead != SPI_TxTail) {
+		// calculate and store new buffer index
+		tmptail = (SPI_TxTail + 1) & SPI_TX_BUFFER_MASK;
+		SPI_TxTail = tmptail;
+		// get one byte from buffer and write it to UART
+		SPI_SEND(SPI_TxBuf[tmptail]);  //start transmission
+		if ( SPI_TxHead == tmptail ) {
+			SPI_EVENT(SPI_EVENT_TX_DRAINED);
+		}
+	} 
+	#if defined (SPI_BRIDGE_ENABLED)
+	else if (SPI_Bridge) {
+		// tell the master whether the next bytes still fit
+		SPI_SEND( ((SPI_RxHead - SPI_RxTail) & SPI_RX_BUFFER_MASK) >= SPI_BRIDGE_HIGH_WATER ?
+			SPI_BRIDGE_FILLER_BUSY : SPI_BRIDGE_FILLER_READY );
+	}
+	#endif
+	else{
+		SPI_SEND(0x00);
+	}
+	
+#endif
+
+}
+#endif
+
+#if defined (SPI_MASTER_ENABLED)
+/*************************************************************************
+Function: spi_master_init()
+Purpose:  Initialize SPI in Master Mode
+Input:    mode SPI_MODEx (x : 0 -> 3)
+Input:    clock SPI_CLOCK_DIVx (x : 2, 4, 8, 16, 32, 64 or 128)
+Returns:  none
+**************************************************************************/
+void spi_master_init(uint8_t mode, uint8_t clock){
+	
+	// Pin Configuration
+	SPI_DDR |= (1<<SPI_PIN_SS);
+	SPI_PORT|= (1<<SPI_PIN_SS);
+	
+	SPI_CTS	 = SPI_INACTIVE; 
+	// Set MOSI and SCK output, all others input
+	SPI_DDR |= (1<<SPI_PIN_MOSI)|(1<<SPI_PIN_SCK);
+	// Enable SPI, Master, set mode and clock rate
+	// SPI_MODEx already sits on CPOL:CPHA, SPI_CLOCK_DIVx bit 2 is SPI2X
+	SPCR = (1<<SPIE)|(1<<SPE)|(1<<MSTR)|(mode & SPI_SPCR_MODE)|((clock & 0x03)<<SPR0);
+	SPSR = (clock & 0x04) ? (1<<SPI2X) : 0;
+
+}
+
+/*************************************************************************
+Function: spi_master_settings()
+Purpose:  change mode, clock rate and bit order between transactions
+Input:    mode SPI_MODEx (x : 0 -> 3)
+Input:    clock SPI_CLOCK_DIVx (x : 2, 4, 8, 16, 32, 64 or 128)
+Input:    bitorder SPI_MSBFIRST or SPI_LSBFIRST
+Returns:  none
+**************************************************************************/
+void spi_master_settings(uint8_t mode, uint8_t clock, uint8_t bitorder){
+	
+	uint8_t spcr;
+	uint8_t applied=0;
+	
+	spcr = SPI_SPCR_OF(mode, clock, bitorder);
+	
+	// wait for the end of the current transaction, then write both registers at once
+	while (!applied) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+			if(SPI_CTS==SPI_INACTIVE){
+				SPCR = (SPCR & ~SPI_SPCR_SETTINGS) | spcr;
+				SPSR = (clock & 0x04) ? (1<<SPI2X) : 0;
+				applied=1;
+			}
+		}
+	}
+}
+
+#if defined (SPI_MINIMAL_ENABLED)
+/*************************************************************************
+Function: spi_master_transfer()
+Purpose:  exchange bytes straight from and into the caller buffers
+Input:    bytes to send or 0 for 0x00, buffer for the received bytes or 0,
+          number of bytes
+Returns:  1 if started, 0 if the bus is busy
+**************************************************************************/
+uint8_t spi_master_transfer(const uint8_t *tx, uint8_t *rx, uint16_t numberOfBytes){
+	
+	uint8_t started=0;
+	
+	if (numberOfBytes == 0) {
+		return 1;
+	}
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(SPI_CTS==SPI_INACTIVE){
+			
+			SPI_DirectTx = tx;
+			SPI_DirectRx = rx;
+			SPI_DirectLeft = numberOfBytes - 1;
+			SPI_State.tx = (tx != 0);
+			SPI_State.rx = (rx != 0);
+			
+			SPI_CTS=SPI_ACTIVE;
+			SPI_PORT&= ~(1<<SPI_PIN_SS); // Pull-down the line
+			SPDR = tx ? *SPI_DirectTx++ : 0x00; /* start transmission */
+			started = 1;
+		}
+	}
+	
+	return started;
+}
+#else
+/*************************************************************************
+Function: spi_master_transmit()
+Purpose:  transmit string to SPI and launch the SPI communication
+Input:    string to be transmitted
+Returns:  ticket of the transaction carrying the string
+**************************************************************************/
+spi_ticket spi_master_transmit(const char *s){
+	
+	spi_ticket ticket;
+	uint16_t length = strlen(s);
+	
+#if defined (SPI_BATCH_ENABLED)
+	// A string that does not fit next to the held bytes starts them first,
+	// the indexes are read atomically as they may be 16-bit wide
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if (SPI_BatchAge && length >= (SPI_TX_BUFFER_SIZE - 1) - ((SPI_TxHead - SPI_TxTail) & SPI_TX_BUFFER_MASK)) {
+			spi_master_flush();
+		}
+	}
+#endif
+	
+	// Stores datas in buffer with one reservation, so that an interrupt
+	// queuing bytes meanwhile cannot split the string. A string that does
+	// not fit is counted by spi_tx_rejected(), nothing of it is sent.
+	spi_write((const uint8_t *)s, length);
+	
+	// Checks if ready to send and proceed, an ISR may start it concurrently
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(SPI_CTS==SPI_INACTIVE && SPI_TxHead != SPI_TxTail){
+			#if defined (SPI_BATCH_ENABLED)
+			if ( ((SPI_TxHead - SPI_TxTail) & SPI_TX_BUFFER_MASK) < SPI_BATCH_THRESHOLD ) {
+				// held for the next writes, started by spi_master_tick() or spi_master_flush()
+				if (!SPI_BatchAge) {
+					SPI_BatchAge = SPI_BATCH_WINDOW;
+				}
+			}
+			else
+			#endif
+			spi_master_start();
+		}
+		// either just started or already running and will send the string
+		ticket = SPI_TxnStarted;
+		#if defined (SPI_BATCH_ENABLED)
+		if (SPI_BatchAge) {
+			ticket++; // held, goes with the next transaction
+		}
+		#endif
+		if (SPI_POLLED_SESSION() && SPI_TxHead != SPI_TxTail) {
+			ticket++;
+		}
+	}
+	
+	return ticket;
+}
+/*************************************************************************
+Function: spi_master_read()
+Purpose:  transmit 0x00 to get the number of bytes requested
+          Queued after the bytes already pending in the transaction
+Input:    numberOfBytes that want to be read
+Returns:  ticket of the transaction reading the bytes
+**************************************************************************/
+spi_ticket spi_master_read(uint16_t numberOfBytes){
+	
+	spi_ticket ticket;
+	
+	if (numberOfBytes == 0) {
+		return SPI_TxnStarted;
+	}
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		// Checks if ready to send and proceed, bytes still queued go first
+		if(SPI_CTS==SPI_INACTIVE){
+			if (spi_master_start()) {
+				numberOfBytes--;
+			}
+		}
+		// Adds to a read or transmit in flight instead of replacing its request
+		SPI_bytesRequest += numberOfBytes;
+		ticket = SPI_TxnStarted;
+		if (SPI_POLLED_SESSION()) {
+			ticket++;
+		}
+	}
+	
+	return ticket;
+}
+#if defined (SPI_SG_ENABLED)
+/*************************************************************************
+Function: spi_master_transfer_segments()
+Purpose:  run a list of segments under one SS assertion
+Input:    list of segments and number of segments
+Returns:  1 if started, 0 if the bus is busy
+**************************************************************************/
+uint8_t spi_master_transfer_segments(const struct spi_segment *segments, uint8_t count){
+	
+	uint8_t started=0;
+	
+#if defined (SPI_BATCH_ENABLED)
+	spi_master_flush(); // held bytes go first, the bus is then busy
+#endif
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(SPI_CTS==SPI_INACTIVE){
+			
+			SPI_SgSegment = segments;
+			SPI_SgCount = count;
+			SPI_SgLeft = 0;
+			
+			SPI_SgActive = 1;
+			SPI_CTS = SPI_ACTIVE;
+			SPI_LATENCY_TXN_START();
+			SPI_PROFILE_TXN_START();
+			SPI_TxnStarted++;
+			SPI_PORT&= ~(1<<SPI_PIN_SS); // Pull-down the line
+			
+			if (!spi_sg_next()) {
+				// nothing to transfer
+				SPI_SgActive = 0;
+				spi_master_stop();
+			}
+			started = 1;
+		}
+	}
+	
+	return started;
+}
+#endif
+
+#if defined (SPI_READAHEAD_ENABLED)
+/*************************************************************************
+Function: spi_master_stream_start()
+Purpose:  read ahead from a sequential slave until spi_master_stream_stop()
+Input:    none
+Returns:  ticket of the transaction streaming the bytes
+**************************************************************************/
+spi_ticket spi_master_stream_start(void){
+	
+	spi_ticket ticket;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		SPI_Stream = SPI_STREAM_RUNNING;
+		
+		// Follows the bytes already queued when a transaction is running
+		if(SPI_CTS==SPI_INACTIVE){
+			spi_master_start();
+		}
+		ticket = SPI_TxnStarted;
+	}
+	
+	return ticket;
+}
+
+/*************************************************************************
+Function: spi_master_stream_stop()
+Purpose:  stop reading ahead, the bytes already received stay available
+Input:    none
+Returns:  none
+**************************************************************************/
+void spi_master_stream_stop(void){
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		// a running stream ends at the next interrupt, a paused one now
+		if (SPI_Stream == SPI_STREAM_PAUSED) {
+			spi_master_stop();
+		}
+		SPI_Stream = SPI_STREAM_OFF;
+	}
+}
+#endif
 
-#if defined (SPI_MASTER_ENABLED) && defined(SPI_SLAVE_ENABLED)
-	#error The multimaster mode of SPI is not yet implement. Do not hesitate to implement it, then submit a pull request ! Thx
-#elif defined(SPI_MASTER_ENABLED)
-	static volatile uint8_t SPI_CTS;
-	static volatile uint8_t SPI_bytesRequest; // Number of bytes request
-#elif defined(SPI_SLAVE_ENABLED)
-	static volatile uint8_t SPI_SPDR;
-	#define SPI_SPDR_EMPTY	0
-	#define SPI_SPDR_FULL	1
+#if defined (SPI_BATCH_ENABLED) || defined (SPI_TIMEOUT_ENABLED)
+/*************************************************************************
+Function: spi_master_tick()
+Purpose:  called periodically, starts the held bytes once SPI_BATCH_WINDOW
+          calls went by and aborts a transaction that stopped progressing
+Input:    none
+Returns:  none
+**************************************************************************/
+void spi_master_tick(void){
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+#if defined (SPI_BATCH_ENABLED)
+		// the window only runs while the bus is idle, a held batch is never
+		// left behind by a polled session or a transaction still running
+		if (SPI_BatchAge && SPI_CTS==SPI_INACTIVE && --SPI_BatchAge == 0) {
+			spi_master_start();
+		}
+#endif
+#if defined (SPI_TIMEOUT_ENABLED)
+		// polled sessions (interrupt disabled) and a paused read-ahead do not progress on purpose
+		if (SPI_CTS==SPI_ACTIVE && (SPCR & (1<<SPIE)) && SPI_TimeoutTicks
+		#if defined (SPI_READAHEAD_ENABLED)
+			&& SPI_Stream != SPI_STREAM_PAUSED
+		#endif
+			&& ++SPI_TimeoutAge >= SPI_TimeoutTicks) {
+			
+			SPI_Timeouts++;
+			spi_master_reset();
+			// drop the rest of the transaction, resending it alone would
+			// give the slave a truncated command
+			SPI_TxTail = SPI_TxHead;
+			SPI_bytesRequest = 0;
+			SPI_EVENT(SPI_EVENT_TIMEOUT);
+		}
+#endif
+	}
+}
 #endif
 
-ISR(SPI_STC_vect)
+#if defined (SPI_BATCH_ENABLED)
+
 /*************************************************************************
-Function: SPI interrupt
-Purpose:  called when the SS pin has been put low
+Function: spi_master_flush()
+Purpose:  start the held bytes now
+Input:    none
+Returns:  ticket of the transaction sending them
 **************************************************************************/
-{
-	uint16_t tmphead=0;
-	uint16_t tmptail=0;
+spi_ticket spi_master_flush(void){
 	
-	/* SPI MASTER */
-#if defined (SPI_MASTER_ENABLED)
+	spi_ticket ticket;
 	
-	//RECEIVE
-	// calculate buffer index 
-	tmphead = ( SPI_RxHead + 1) & SPI_RX_BUFFER_MASK;
-	if ( tmphead == SPI_RxTail ) {
-		// error: receive buffer overflow
-				
-		} else {
-		// store new index
-		SPI_RxHead = tmphead;
-		// store received data in buffer
-		SPI_RxBuf[tmphead] = SPDR;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if (SPI_BatchAge && SPI_CTS==SPI_INACTIVE) {
+			spi_master_start();
+		}
+		ticket = SPI_TxnStarted;
 	}
+	
+	return ticket;
+}
+#endif
 
-	// SEND
-	if ( SPI_TxHead != SPI_TxTail) {
-		// calculate and store new buffer index 
-		tmptail = (SPI_TxTail + 1) & SPI_TX_BUFFER_MASK;
-		SPI_TxTail = tmptail;
-		// get one byte from buffer and write it to UART
-		SPDR = SPI_TxBuf[tmptail];  // start transmission 
-		} 
-	else if(SPI_bytesRequest>0){
-		SPI_bytesRequest--;
-		SPDR = 0x00;
-	}
-	else {
-		// tx buffer empty, STOP the transmission
-		SPI_PORT|= (1<<SPI_PIN_SS);
-		SPI_CTS = SPI_INACTIVE;
-	}
+#if defined (SPI_TIMEOUT_ENABLED)
+/*************************************************************************
+Function: spi_master_timeout()
+Purpose:  set the timeout policy, for the next transactions
+Input:    ticks spi_master_tick() calls without progress, 0 disables
+Returns:  none
+**************************************************************************/
+void spi_master_timeout(uint8_t ticks){
+	
+	SPI_TimeoutTicks = ticks;
+}
 
-	/* SPI Slave */
-#elif defined(SPI_SLAVE_ENABLED)
-		
-	//RECEIVE
-	// calculate buffer index
-	tmphead = ( SPI_RxHead + 1) & SPI_RX_BUFFER_MASK;
-	if ( tmphead == SPI_RxTail ) {
-		// error: receive buffer overflow
-					
-		} else {
-		// store new index
-		SPI_RxHead = tmphead;
-		// store received data in buffer
-		SPI_RxBuf[tmphead] = SPDR;
+/*************************************************************************
+Function: spi_master_abort()
+Purpose:  end the running transaction now and drop the queued bytes
+Input:    none
+Returns:  none
+**************************************************************************/
+void spi_master_abort(void){
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		// a polled session belongs to its caller
+		if (SPI_CTS==SPI_ACTIVE && (SPCR & (1<<SPIE))) {
+			spi_master_reset();
+		}
+		SPI_TxTail = SPI_TxHead;
+		SPI_bytesRequest = 0;
+#if defined (SPI_BATCH_ENABLED)
+		SPI_BatchAge = 0;
+#endif
 	}
+}
 
-	// SEND
-	if ( SPI_TxHead != SPI_TxTail) {
-		// calculate and store new buffer index
-		tmptail = (SPI_TxTail + 1) & SPI_TX_BUFFER_MASK;
-		SPI_TxTail = tmptail;
-		// get one byte from buffer and write it to UART
-		SPDR = SPI_TxBuf[tmptail];  //start transmission
-	} 
-	else{
-		SPDR=0x00;
-	}
+/*************************************************************************
+Function: spi_timeouts()
+Purpose:  number of transactions aborted on timeout
+Input:    none
+Returns:  timeouts since reset, wraps around
+**************************************************************************/
+uint16_t spi_timeouts(void){
+	
+	uint16_t timeouts;
 	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		timeouts = SPI_Timeouts;
+	}
+	return timeouts;
+}
 #endif
 
+/*************************************************************************
+Function: spi_async_done()
+Purpose:  tell if the transaction of a ticket has ended
+Input:    ticket returned by spi_master_transmit() or spi_master_read()
+Returns:  1 if done, 0 if still queued or running
+**************************************************************************/
+uint8_t spi_async_done(spi_ticket ticket){
+	// wrap-around safe as long as less than 128 transactions are in flight
+	return ((int8_t)(SPI_TxnDone - ticket) >= 0);
 }
 
-#if defined (SPI_MASTER_ENABLED)
+#endif /* SPI_MINIMAL_ENABLED */
+
 /*************************************************************************
-Function: spi_master_init()
-Purpose:  Initialize SPI in Master Mode
+Function: spi_master_busy()
+Purpose:  tell if a transaction is in progress
+Input:    none
+Returns:  1 if busy, 0 if idle
+**************************************************************************/
+uint8_t spi_master_busy(void){
+	return (SPI_CTS == SPI_ACTIVE);
+}
+
+static uint8_t SPI_SavedSPCR; // Settings of the interrupt driven transfers,
+static uint8_t SPI_SavedSPSR; // restored by spi_master_release()
+
+/*************************************************************************
+Function: spi_master_acquire()
+Purpose:  wait for the bus and disable the SPI interrupt for polled use
+Input:    none
+Returns:  none
+**************************************************************************/
+void spi_master_acquire(void){
+	
+	uint8_t acquired=0;
+	
+#if defined (SPI_BATCH_ENABLED)
+	spi_master_flush(); // held bytes go first
+#endif
+	
+	while (!acquired) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+			if(SPI_CTS==SPI_INACTIVE){
+				SPI_CTS=SPI_ACTIVE;
+				SPI_SavedSPCR = SPCR;
+				SPI_SavedSPSR = SPSR & (1<<SPI2X);
+				SPCR &= ~(1<<SPIE);
+				SPI_PROFILE_TXN_START();
+				acquired=1;
+			}
+		}
+	}
+}
+
+/*************************************************************************
+Function: spi_master_acquire_settings()
+Purpose:  take the bus with the settings of a device, for polled use
 Input:    mode SPI_MODEx (x : 0 -> 3)
 Input:    clock SPI_CLOCK_DIVx (x : 2, 4, 8, 16, 32, 64 or 128)
+Input:    bitorder SPI_MSBFIRST or SPI_LSBFIRST
 Returns:  none
 **************************************************************************/
-void spi_master_init(uint8_t mode, uint8_t clock){
+void spi_master_acquire_settings(uint8_t mode, uint8_t clock, uint8_t bitorder){
 	
-	// Pin Configuration
-	SPI_DDR |= (1<<SPI_PIN_SS);
-	SPI_PORT|= (1<<SPI_PIN_SS);
+	spi_master_acquire();
+	SPCR = (SPCR & ~SPI_SPCR_SETTINGS) | SPI_SPCR_OF(mode, clock, bitorder);
+	SPSR = (clock & 0x04) ? (1<<SPI2X) : 0;
+}
+
+/*************************************************************************
+Function: spi_master_release()
+Purpose:  restore the settings and enable the SPI interrupt again after
+          polled use, then start the bytes queued during the session
+Input:    none
+Returns:  none
+**************************************************************************/
+void spi_master_release(void){
 	
-	SPI_CTS	 = SPI_INACTIVE; 
-	// Set MOSI and SCK output, all others input
-	SPI_DDR |= (1<<SPI_PIN_MOSI)|(1<<SPI_PIN_SCK);
-	// Enable SPI, Master, set clock rate
-	SPCR = (1<<SPIE)|(1<<SPE)|(1<<MSTR)|(mode<<CPHA)|(clock<<SPR0);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		SPSR = SPI_SavedSPSR;
+		SPCR = SPI_SavedSPCR;
+		SPI_CTS=SPI_INACTIVE;
+		SPI_PROFILE_TXN_END();
+#if !defined (SPI_MINIMAL_ENABLED)
+		if (SPI_TxHead != SPI_TxTail || SPI_bytesRequest) {
+			if (spi_master_start()) {
+				SPI_bytesRequest--;
+			}
+		}
+#endif
+	}
+}
+
+/*************************************************************************
+Function: spi_master_set_clock()
+Purpose:  change the clock rate
+Input:    clock SPI_CLOCK_DIVx (x : 2, 4, 8, 16, 32, 64 or 128)
+Returns:  none
+**************************************************************************/
+void spi_master_set_clock(uint8_t clock){
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		SPCR = (SPCR & ~((1<<SPR1)|(1<<SPR0))) | ((clock & 0x03)<<SPR0);
+		SPSR = (clock & 0x04) ? (1<<SPI2X) : 0;
+	}
+}
 
+/*************************************************************************
+Function: spi_master_exchange()
+Purpose:  polled exchange of one byte
+Input:    byte to be transmitted
+Returns:  byte received
+**************************************************************************/
+uint8_t spi_master_exchange(uint8_t data){
+	
+	SPI_PROFILE_BYTES(1);
+	SPDR = data;
+	while (!(SPSR & (1<<SPIF)));
+	
+	return SPDR;
 }
 
 /*************************************************************************
-Function: spi_master_transmit()
-Purpose:  transmit string to SPI and launch the SPI communication
-Input:    string to be transmitted
+Function: spi_master_read_block()
+Purpose:  polled read of a block
+Input:    buffer, numberOfBytes to read, filler byte sent meanwhile
 Returns:  none
 **************************************************************************/
-void spi_master_transmit(const char *s){
+void spi_master_read_block(uint8_t *data, uint16_t numberOfBytes, uint8_t filler){
 	
-	uint16_t tmptail=0;
+	uint8_t received;
 	
-	// Stores datas in buffer
-	while (*s) {
-		spi_putc(*s++);
+	if (numberOfBytes == 0) {
+		return;
 	}
+	SPI_PROFILE_BYTES(numberOfBytes);
+	SPDR = filler;
+	while (--numberOfBytes) {
+		while (!(SPSR & (1<<SPIF)));
+		received = SPDR;
+		SPDR = filler;		// start the next byte before storing
+		*data++ = received;
+	}
+	while (!(SPSR & (1<<SPIF)));
+	*data = SPDR;
+}
+
+/*************************************************************************
+Function: spi_master_write_block()
+Purpose:  polled write of a block
+Input:    bytes to be transmitted, numberOfBytes to write
+Returns:  none
+**************************************************************************/
+void spi_master_write_block(const uint8_t *data, uint16_t numberOfBytes){
 	
-	// Checks if ready to send and proceed
-	if(SPI_CTS==SPI_INACTIVE){
-		
-		SPI_CTS=SPI_ACTIVE;
-		SPI_PORT&= ~(1<<SPI_PIN_SS); // Pull-down the line
-		
-		if ( SPI_TxHead != SPI_TxTail) {
-			tmptail = (SPI_TxTail + 1) & SPI_TX_BUFFER_MASK;
-			SPI_TxTail = tmptail;
-			/* get one byte from buffer and write it to UART */
-			SPDR = SPI_TxBuf[tmptail];  /* start transmission */
-		}
+	uint8_t next;
+	
+	if (numberOfBytes == 0) {
+		return;
+	}
+	SPI_PROFILE_BYTES(numberOfBytes);
+	SPDR = *data++;
+	while (--numberOfBytes) {
+		next = *data++;		// fetch while the current byte is shifted out
+		while (!(SPSR & (1<<SPIF)));
+		SPDR = next;
+	}
+	while (!(SPSR & (1<<SPIF)));
+	next = SPDR;			// clear SPIF
+}
+
+/*************************************************************************
+Function: spi_master_exchange_word()
+Purpose:  polled exchange of a 16, 24 or 32-bit word
+Input:    word to be transmitted, size in bytes (1 to 4),
+          SPI_WORD_x byte order, the same for both directions
+Returns:  word received
+**************************************************************************/
+uint32_t spi_master_exchange_word(uint32_t word, uint8_t size, uint8_t order){
+	
+	uint32_t received = 0;
+	const uint8_t *out = (const uint8_t *)&word;	// little-endian on AVR
+	uint8_t *in = (uint8_t *)&received;
+	int8_t step = 1;
+	
+	SPI_PROFILE_BYTES(size);
+	if (order == SPI_WORD_BIG_ENDIAN) {
+		out += size - 1;
+		in += size - 1;
+		step = -1;
+	}
+	while (size--) {
+		SPDR = *out;
+		out += step;
+		while (!(SPSR & (1<<SPIF)));
+		*in = SPDR;
+		in += step;
 	}
 	
+	return received;
 }
+
 /*************************************************************************
-Function: spi_master_read()
-Purpose:  transmit 0x00 to get the number of bytes requested
-Input:    numberOfBytes that want to be read
+Function: spi_master_read_words()
+Purpose:  polled read of an array of words, 0x00 sent meanwhile
+Input:    words (uint16_t for size 2, uint32_t for size 3 or 4), number
+          of words, size in bytes (1 to 4), SPI_WORD_x byte order
 Returns:  none
 **************************************************************************/
-void spi_master_read(uint8_t numberOfBytes){
+void spi_master_read_words(void *words, uint16_t count, uint8_t size, uint8_t order){
 	
-	SPI_bytesRequest = numberOfBytes;
+	uint8_t *word = (uint8_t *)words;
+	uint8_t stride = (size > 2) ? 4 : size;
+	uint8_t received;
+	uint8_t i;
 	
-	// Checks if ready to send and proceed
-	if(SPI_CTS==SPI_INACTIVE){
-			
-		SPI_CTS=SPI_ACTIVE;
-		SPI_PORT&= ~(1<<SPI_PIN_SS); // Pull-down the line
-		SPDR = 0x00; /* start transmission */
+	if (count == 0) {
+		return;
+	}
+	SPI_PROFILE_BYTES(count * size);
+	SPDR = 0x00;
+	while (count--) {
+		word[stride - 1] = 0;	// high byte of a 24-bit word
+		for (i = 0; i < size; i++) {
+			while (!(SPSR & (1<<SPIF)));
+			received = SPDR;
+			if (count || i < size - 1) {
+				SPDR = 0x00;	// start the next byte before storing
+			}
+			word[(order == SPI_WORD_BIG_ENDIAN) ? (size - 1 - i) : i] = received;
+		}
+		word += stride;
+	}
+}
+
+/*************************************************************************
+Function: spi_master_write_words()
+Purpose:  polled write of an array of words
+Input:    words (uint16_t for size 2, uint32_t for size 3 or 4), number
+          of words, size in bytes (1 to 4), SPI_WORD_x byte order
+Returns:  none
+**************************************************************************/
+void spi_master_write_words(const void *words, uint16_t count, uint8_t size, uint8_t order){
+	
+	const uint8_t *word = (const uint8_t *)words;
+	uint8_t stride = (size > 2) ? 4 : size;
+	uint8_t started = 0;
+	uint8_t next;
+	uint8_t i;
+	
+	if (count == 0) {
+		return;
 	}
+	SPI_PROFILE_BYTES(count * size);
+	while (count--) {
+		for (i = 0; i < size; i++) {
+			next = word[(order == SPI_WORD_BIG_ENDIAN) ? (size - 1 - i) : i];	// fetch while the current byte is shifted out
+			if (started) {
+				while (!(SPSR & (1<<SPIF)));
+			}
+			SPDR = next;
+			started = 1;
+		}
+		word += stride;
+	}
+	while (!(SPSR & (1<<SPIF)));
+	next = SPDR;			// clear SPIF
 }
+
 /*void spi_master_addSlave(spi_slave_info slave){
 	
 }
@@ -238,13 +1458,141 @@ void spi_slave_init(void){
 	uint8_t dump=0x00;
 	dump=SPSR;
 	dump=SPDR;
-	SPDR=0x00; // Set SPDR to 0x00
+	SPI_SEND(0x00); // Set SPDR to 0x00
 	
+#if !defined (SPI_MINIMAL_ENABLED)
 	SPI_SPDR = SPI_SPDR_EMPTY;
+#endif
+
+}
+
+#if defined (SPI_MINIMAL_ENABLED)
+/*************************************************************************
+Function: spi_slave_transfer()
+Purpose:  arm the caller buffers for the next bytes clocked by the master
+Input:    bytes to answer or 0 for 0x00, buffer for the received bytes or 0,
+          number of bytes
+Returns:  none
+**************************************************************************/
+void spi_slave_transfer(const uint8_t *tx, uint8_t *rx, uint16_t numberOfBytes){
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		SPI_DirectTx = tx;
+		SPI_DirectRx = rx;
+		SPI_DirectLeft = numberOfBytes;
+		SPI_State.tx = (tx != 0);
+		SPI_State.rx = (rx != 0);
+		SPDR = (numberOfBytes && tx) ? *SPI_DirectTx++ : 0x00;
+	}
+}
+
+/*************************************************************************
+Function: spi_slave_busy()
+Purpose:  tell if the armed buffers still wait for bytes
+Input:    none
+Returns:  1 if busy, 0 once every byte has been exchanged
+**************************************************************************/
+uint8_t spi_slave_busy(void){
+	
+	uint8_t busy;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		busy = (SPI_DirectLeft != 0);
+	}
+	return busy;
+}
+#endif
+
+#if defined (SPI_REGMAP_ENABLED)
+/*************************************************************************
+Function: spi_slave_regmap()
+Purpose:  Answer the master from a register map instead of the ringbuffers
+Input:    map of registers sorted or not, number of registers
+Returns:  none
+**************************************************************************/
+void spi_slave_regmap(const struct spi_register *map, uint8_t count){
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		SPI_RegCount = count;
+		SPI_RegMap = count ? map : 0;
+		SPI_RegState = SPI_REG_COMMAND;
+		
+		if (SPI_RegMap) {
+			SPI_SS_PCMSK |= (1<<SPI_SS_PCINT);
+			PCICR |= (1<<SPI_SS_PCIE);
+		} else {
+			SPI_SS_PCMSK &= ~(1<<SPI_SS_PCINT);
+		}
+	}
+}
+#endif
+
+#endif
+#if defined (SPI_SLAVE_ENABLED) && defined (SPI_BRIDGE_ENABLED)
+ISR(SPI_BRIDGE_UDRE_vect)
+/*************************************************************************
+Function: USART data register empty interrupt
+Purpose:  forward the next received byte to the USART
+**************************************************************************/
+{
+	uint16_t tmptail;
+	
+	if ( SPI_RxHead != SPI_RxTail ) {
+		tmptail = (SPI_RxTail + 1) & SPI_RX_BUFFER_MASK;
+		SPI_RxTail = tmptail;
+		UDR0 = SPI_RxBuf[tmptail];
+		SPI_LATENCY_RX_POP(tmptail);
+	}
+	if ( SPI_RxHead == SPI_RxTail ) {
+		UCSR0B &= ~(1<<UDRIE0);
+	}
+}
 
+/*************************************************************************
+Function: spi_bridge_start()
+Purpose:  forward the bytes received by the slave to USART0
+Input:    ubrr baud rate register value, mode SPI_BRIDGE_UART or
+          SPI_BRIDGE_MSPIM | SPI_MODEx
+Returns:  none
+**************************************************************************/
+void spi_bridge_start(uint16_t ubrr, uint8_t mode){
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		UCSR0B &= ~(1<<UDRIE0);
+		UBRR0 = 0;
+		if (mode & SPI_BRIDGE_MSPIM) {
+			// USART in SPI master mode, UCPOL0/UCPHA0 from the SPI mode
+			SPI_BRIDGE_XCK_DDR |= (1<<SPI_BRIDGE_XCK_PIN);
+			UCSR0C = (1<<UMSEL01)|(1<<UMSEL00)|((mode & SPI_MODE2) ? (1<<UCPOL0) : 0)|((mode & SPI_MODE1) ? (1<<UCPHA0) : 0);
+		} else {
+			// asynchronous 8N1
+			UCSR0C = (1<<UCSZ01)|(1<<UCSZ00);
+		}
+		UCSR0B = (1<<TXEN0);
+		UBRR0 = ubrr;
+		
+		SPI_Bridge = 1;
+		if ( SPI_RxHead != SPI_RxTail ) {
+			UCSR0B |= (1<<UDRIE0);
+		}
+	}
+}
+
+/*************************************************************************
+Function: spi_bridge_stop()
+Purpose:  stop forwarding, the next bytes stay in the receive buffer
+Input:    none
+Returns:  none
+**************************************************************************/
+void spi_bridge_stop(void){
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		SPI_Bridge = 0;
+		UCSR0B &= ~(1<<UDRIE0);
+	}
 }
-
 #endif
+
 /*************************************************************************
 Function: spi_close()
 Purpose:  Close SPI, flush and clear any received datas
@@ -253,7 +1601,9 @@ Returns:  none
 **************************************************************************/
 void spi_close(void){
 	
+#if !defined (SPI_MINIMAL_ENABLED)
 	spi_flush();
+#endif
 	
 	SPCR = (0x00);
 	SPI_DDR &= ~(1<<SPI_PIN_SS);
@@ -261,6 +1611,31 @@ void spi_close(void){
 	
 }
 
+#if !defined (SPI_MINIMAL_ENABLED)
+#if defined (SPI_MASTER_ENABLED) && defined (SPI_READAHEAD_ENABLED)
+/*************************************************************************
+Function: spi_readahead_resume()
+Purpose:  resume the read-ahead once the application caught up
+Input:    none
+Returns:  none
+**************************************************************************/
+static inline void spi_readahead_resume(void)
+{
+	if (SPI_Stream == SPI_STREAM_PAUSED) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+			if (SPI_Stream == SPI_STREAM_PAUSED &&
+				((SPI_RxHead - SPI_RxTail) & SPI_RX_BUFFER_MASK) <= SPI_READAHEAD_LOW_WATER) {
+				SPI_Stream = SPI_STREAM_RUNNING;
+				SPI_SEND(0x00);
+			}
+		}
+	}
+}
+	#define SPI_READAHEAD_RESUME()	spi_readahead_resume()
+#else
+	#define SPI_READAHEAD_RESUME()
+#endif
+
 /*************************************************************************
 Function: spi_getc()
 Purpose:  return byte from ringbuffer
@@ -271,20 +1646,70 @@ uint8_t spi_getc(void)
 	uint16_t tmptail;
 	uint8_t data;
 
-	if ( SPI_RxHead == SPI_RxTail ) {
-		/* no data available */
-	}
+	SPI_RX_ATOMIC{
+		if ( SPI_RxHead == SPI_RxTail ) {
+			/* no data available */
+		}
 
-	/* calculate /store buffer index */
-	tmptail = (SPI_RxTail + 1) & SPI_RX_BUFFER_MASK;
-	SPI_RxTail = tmptail;
+		/* calculate /store buffer index */
+		tmptail = (SPI_RxTail + 1) & SPI_RX_BUFFER_MASK;
+		SPI_RxTail = tmptail;
+	}
 
 	/* get data from receive buffer */
 	data = SPI_RxBuf[tmptail];
+	SPI_LATENCY_RX_POP(tmptail);
+	SPI_READAHEAD_RESUME();
 
 	return data;
 }
 
+/*************************************************************************
+Function: spi_tx_reserve()
+Purpose:  reserve room for bytes in the transmit ringbuffer
+          Only the index update is atomic, the reserved bytes are filled
+          with interrupts enabled. Works from main and from any ISR: an ISR
+          reserving while main holds a reservation is committed with it.
+Input:    number of bytes to reserve
+Returns:  index preceding the first reserved byte, SPI_TX_NO_ROOM if full
+**************************************************************************/
+#define SPI_TX_NO_ROOM	0xFFFF
+
+static uint16_t spi_tx_reserve(uint16_t count)
+{
+	uint16_t start = SPI_TX_NO_ROOM;
+	uint16_t used;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		used = (SPI_TxReserve - SPI_TxTail) & SPI_TX_BUFFER_MASK;
+		if (count <= (SPI_TX_BUFFER_MASK - used)) {
+			start = SPI_TxReserve;
+			SPI_TxReserve = (start + count) & SPI_TX_BUFFER_MASK;
+			SPI_TxPending++;
+		}
+		else {
+			SPI_TxRejected += count;
+		}
+	}
+	return start;
+}
+
+/*************************************************************************
+Function: spi_tx_commit()
+Purpose:  release a reservation, the bytes are published to the ISR once
+          the outermost reservation is committed
+Input:    none
+Returns:  none
+**************************************************************************/
+static void spi_tx_commit(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if (--SPI_TxPending == 0) {
+			SPI_TxHead = SPI_TxReserve; // atomic even with 16-bit indexes
+		}
+	}
+}
+
 /*************************************************************************
 Function: spi_putc()
 Purpose:  write byte to ringbuffer for transmitting via SPI
@@ -295,25 +1720,120 @@ void spi_putc(uint8_t data)
 {
 	uint16_t tmphead;
 
-	tmphead  = (SPI_TxHead + 1) & SPI_TX_BUFFER_MASK;
-	
 	#if defined (SPI_SLAVE_ENABLED)
 	// If no char in SPDR -> fill directly
-	if (SPI_TxHead == SPI_TxTail && SPI_SPDR==SPI_SPDR_EMPTY){
-		SPDR = data;
-		SPI_SPDR = SPI_SPDR_FULL;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if (SPI_TxReserve == SPI_TxTail && SPI_SPDR==SPI_SPDR_EMPTY){
+			SPI_SEND(data);
+			SPI_SPDR = SPI_SPDR_FULL;
+			SPI_EVENT(SPI_EVENT_TX_DRAINED); // nothing left behind it
+			return;
+		}
+	}
+	#endif
+	
+	tmphead = spi_tx_reserve(1);
+	if (tmphead != SPI_TX_NO_ROOM){
+		SPI_TxBuf[(tmphead + 1) & SPI_TX_BUFFER_MASK] = data;
+		spi_tx_commit();
+	}
+	
+}
+
+/*************************************************************************
+Function: spi_write()
+Purpose:  write a block of bytes to ringbuffer, all or nothing
+Input:    bytes to be transmitted and their number
+Returns:  1 if queued, 0 if the ringbuffer has not enough room
+**************************************************************************/
+uint8_t spi_write(const uint8_t *data, uint16_t count)
+{
+	uint16_t tmphead;
+	
+	tmphead = spi_tx_reserve(count);
+	if (tmphead == SPI_TX_NO_ROOM){
+		return 0;
 	}
-	else if (tmphead != SPI_TxTail){
-		SPI_TxBuf[tmphead] = data;
-		SPI_TxHead = tmphead;
+	while (count--) {
+		tmphead = (tmphead + 1) & SPI_TX_BUFFER_MASK;
+		SPI_TxBuf[tmphead] = *data++;
+	}
+	spi_tx_commit();
+	
+	return 1;
+}
+
+/*************************************************************************
+Function: spi_tx_word()
+Purpose:  copy one word into reserved room of the transmit ringbuffer
+Input:    index preceding the room, bytes of the word in memory order
+          (little-endian on AVR), size in bytes, SPI_WORD_x byte order
+Returns:  index of the last byte copied
+**************************************************************************/
+static uint16_t spi_tx_word(uint16_t index, const uint8_t *word, uint8_t size, uint8_t order)
+{
+	int8_t step = 1;
+	
+	if (order == SPI_WORD_BIG_ENDIAN) {
+		word += size - 1;
+		step = -1;
 	}
-	#elif defined (SPI_MASTER_ENABLED)
-	if (tmphead != SPI_TxTail){
-		SPI_TxBuf[tmphead] = data;
-		SPI_TxHead = tmphead;
+	while (size--) {
+		index = (index + 1) & SPI_TX_BUFFER_MASK;
+		SPI_TxBuf[index] = *word;
+		word += step;
 	}
-	#endif
+	return index;
+}
+
+/*************************************************************************
+Function: spi_write_word()
+Purpose:  write a 16, 24 or 32-bit word to ringbuffer, all or nothing
+Input:    word, size in bytes (1 to 4), SPI_WORD_x byte order
+Returns:  1 if queued, 0 if the ringbuffer has not enough room
+**************************************************************************/
+uint8_t spi_write_word(uint32_t word, uint8_t size, uint8_t order)
+{
+	uint16_t tmphead;
+	
+	tmphead = spi_tx_reserve(size);
+	if (tmphead == SPI_TX_NO_ROOM){
+		return 0;
+	}
+	spi_tx_word(tmphead, (const uint8_t *)&word, size, order);
+	spi_tx_commit();
+	
+	return 1;
+}
+
+/*************************************************************************
+Function: spi_write_words()
+Purpose:  write an array of words to ringbuffer, all or nothing
+Input:    words (uint16_t for size 2, uint32_t for size 3 or 4), number
+          of words, size in bytes (1 to 4), SPI_WORD_x byte order
+Returns:  1 if queued, 0 if the ringbuffer has not enough room
+**************************************************************************/
+uint8_t spi_write_words(const void *words, uint16_t count, uint8_t size, uint8_t order)
+{
+	const uint8_t *word = (const uint8_t *)words;
+	uint8_t stride = (size > 2) ? 4 : size;
+	uint16_t tmphead;
+	
+	// the byte count wraps around 16 bits before spi_tx_reserve() sees it
+	if ((uint32_t)count * size > SPI_TX_BUFFER_MASK) {
+		return 0;
+	}
+	tmphead = spi_tx_reserve(count * size);
+	if (tmphead == SPI_TX_NO_ROOM){
+		return 0;
+	}
+	while (count--) {
+		tmphead = spi_tx_word(tmphead, word, size, order);
+		word += stride;
+	}
+	spi_tx_commit();
 	
+	return 1;
 }
 
 /*************************************************************************
@@ -338,7 +1858,50 @@ Returns:  Integer number of bytes in the receive buffer
 **************************************************************************/
 uint16_t spi_available(void)
 {
-	return (SPI_RX_BUFFER_SIZE + SPI_RxHead - SPI_RxTail) & SPI_RX_BUFFER_MASK;
+	uint16_t available;
+	
+	SPI_RX_ATOMIC{
+		available = (SPI_RX_BUFFER_SIZE + SPI_RxHead - SPI_RxTail) & SPI_RX_BUFFER_MASK;
+	}
+	return available;
+}
+
+/*************************************************************************
+Function: spi_read_word()
+Purpose:  get a 16, 24 or 32-bit word from the receive buffer
+Input:    word to fill, size in bytes (1 to 4), SPI_WORD_x byte order
+Returns:  1 if read, 0 if fewer than size bytes are waiting (none taken)
+**************************************************************************/
+uint8_t spi_read_word(uint32_t *word, uint8_t size, uint8_t order)
+{
+	uint8_t *data = (uint8_t *)word;
+	int8_t step = 1;
+	uint16_t tmptail;
+	
+	if (spi_available() < size) {
+		return 0;
+	}
+	*word = 0;
+	if (order == SPI_WORD_BIG_ENDIAN) {
+		data += size - 1;
+		step = -1;
+	}
+	
+	SPI_RX_ATOMIC{
+		tmptail = SPI_RxTail;
+	}
+	while (size--) {
+		tmptail = (tmptail + 1) & SPI_RX_BUFFER_MASK;
+		*data = SPI_RxBuf[tmptail];
+		SPI_LATENCY_RX_POP(tmptail);
+		data += step;
+	}
+	SPI_RX_ATOMIC{
+		SPI_RxTail = tmptail;
+	}
+	SPI_READAHEAD_RESUME();
+	
+	return 1;
 }
 
 /*************************************************************************
@@ -349,5 +1912,322 @@ Returns:  None
 **************************************************************************/
 void spi_flush(void)
 {
-	SPI_RxHead = SPI_RxTail;
-}
\ No newline at end of file
+	SPI_RX_ATOMIC{
+		SPI_RxTail = SPI_RxHead;
+	}
+}
+#endif
+
+#if defined (SPI_LATENCY_ENABLED)
+/*************************************************************************
+Function: spi_latency_dump()
+Purpose:  Copy the latency histograms collected so far
+Input:    structure to fill
+Returns:  None
+**************************************************************************/
+void spi_latency_dump(struct spi_latency_stats *stats)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		memcpy(stats, &SPI_LatencyStats, sizeof(SPI_LatencyStats));
+	}
+}
+
+/*************************************************************************
+Function: spi_latency_reset()
+Purpose:  Clear the latency histograms
+Input:    None
+Returns:  None
+**************************************************************************/
+void spi_latency_reset(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		memset(&SPI_LatencyStats, 0, sizeof(SPI_LatencyStats));
+	}
+}
+#endif
+
+#if defined (SPI_MASTER_ENABLED) && defined (SPI_PROFILE_ENABLED)
+/*************************************************************************
+Function: spi_profile_slave()
+Purpose:  Account the next transactions to a slave
+Input:    slave number, 0 to SPI_PROFILE_SLAVES-1
+Returns:  None
+**************************************************************************/
+void spi_profile_slave(uint8_t slave)
+{
+	if (slave < SPI_PROFILE_SLAVES) {
+		SPI_ProfileSlave = slave;
+	}
+}
+
+/*************************************************************************
+Function: spi_profile_dump()
+Purpose:  Copy the bus counters collected so far
+Input:    structure to fill
+Returns:  None
+**************************************************************************/
+void spi_profile_dump(struct spi_profile_stats *stats)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		memcpy(stats, &SPI_ProfileStats, sizeof(SPI_ProfileStats));
+	}
+}
+
+/*************************************************************************
+Function: spi_profile_reset()
+Purpose:  Clear the bus counters
+Input:    None
+Returns:  None
+**************************************************************************/
+void spi_profile_reset(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		memset(&SPI_ProfileStats, 0, sizeof(SPI_ProfileStats));
+		SPI_ProfileIdle = 0;
+	}
+}
+#endif
+
+#if defined (SPI_SOFT_ENABLED)
+/*************************************************************************
+	Software SPI
+	Pins are resolved at compile time so that every access below is a
+	single sbi/cbi/sbic instruction.
+*************************************************************************/
+
+// CPOL gives the idle level, leading edge leaves it and trailing edge returns to it
+#if ( SPI_SOFT_MODE & 0x08 )
+	#define SPI_SOFT_SCK_IDLE()		SPI_IO_HIGH(SPI_SOFT_SCK)
+	#define SPI_SOFT_SCK_LEADING()	SPI_IO_LOW(SPI_SOFT_SCK)
+#else
+	#define SPI_SOFT_SCK_IDLE()		SPI_IO_LOW(SPI_SOFT_SCK)
+	#define SPI_SOFT_SCK_LEADING()	SPI_IO_HIGH(SPI_SOFT_SCK)
+#endif
+#define SPI_SOFT_SCK_TRAILING()		SPI_SOFT_SCK_IDLE()
+
+#define SPI_SOFT_SHIFT_OUT(n)	do { if (data & (1<<(n))) SPI_IO_HIGH(SPI_SOFT_MOSI); else SPI_IO_LOW(SPI_SOFT_MOSI); } while (0)
+#define SPI_SOFT_SHIFT_IN(n)	do { if (SPI_IO_IS_HIGH(SPI_SOFT_MISO)) received |= (1<<(n)); } while (0)
+
+// CPHA=0 samples on the leading edge, CPHA=1 on the trailing edge
+#if ( SPI_SOFT_MODE & 0x04 )
+	#define SPI_SOFT_BIT(n)	SPI_SOFT_SCK_LEADING(); SPI_SOFT_SHIFT_OUT(n); SPI_SOFT_SCK_TRAILING(); SPI_SOFT_SHIFT_IN(n)
+#else
+	#define SPI_SOFT_BIT(n)	SPI_SOFT_SHIFT_OUT(n); SPI_SOFT_SCK_LEADING(); SPI_SOFT_SHIFT_IN(n); SPI_SOFT_SCK_TRAILING()
+#endif
+
+/*************************************************************************
+Function: spi_soft_init()
+Purpose:  Initialize the software SPI pins
+Input:    none
+Returns:  none
+**************************************************************************/
+void spi_soft_init(void){
+	
+	SPI_IO_HIGH(SPI_SOFT_SS);
+	SPI_IO_OUTPUT(SPI_SOFT_SS);
+	SPI_SOFT_SCK_IDLE();
+	SPI_IO_OUTPUT(SPI_SOFT_SCK);
+	SPI_IO_OUTPUT(SPI_SOFT_MOSI);
+	SPI_IO_INPUT(SPI_SOFT_MISO);
+	
+}
+
+/*************************************************************************
+Function: spi_soft_select()
+Purpose:  Pull the software SS line low
+Input:    none
+Returns:  none
+**************************************************************************/
+void spi_soft_select(void){
+	SPI_IO_LOW(SPI_SOFT_SS);
+}
+
+/*************************************************************************
+Function: spi_soft_deselect()
+Purpose:  Put the software SS line high
+Input:    none
+Returns:  none
+**************************************************************************/
+void spi_soft_deselect(void){
+	SPI_IO_HIGH(SPI_SOFT_SS);
+}
+
+/*************************************************************************
+Function: spi_soft_transfer()
+Purpose:  Exchange one byte, the bit loop is fully unrolled
+Input:    byte to be transmitted
+Returns:  byte received
+**************************************************************************/
+uint8_t spi_soft_transfer(uint8_t data){
+	
+	uint8_t received=0;
+	
+#if ( SPI_SOFT_BITORDER == SPI_LSBFIRST )
+	SPI_SOFT_BIT(0); SPI_SOFT_BIT(1); SPI_SOFT_BIT(2); SPI_SOFT_BIT(3);
+	SPI_SOFT_BIT(4); SPI_SOFT_BIT(5); SPI_SOFT_BIT(6); SPI_SOFT_BIT(7);
+#else
+	SPI_SOFT_BIT(7); SPI_SOFT_BIT(6); SPI_SOFT_BIT(5); SPI_SOFT_BIT(4);
+	SPI_SOFT_BIT(3); SPI_SOFT_BIT(2); SPI_SOFT_BIT(1); SPI_SOFT_BIT(0);
+#endif
+	
+	return received;
+}
+
+/*************************************************************************
+Function: spi_soft_transmit()
+Purpose:  transmit string on the software SPI
+Input:    string to be transmitted
+Returns:  none
+**************************************************************************/
+void spi_soft_transmit(const char *s){
+	
+	spi_soft_select();
+	while (*s) {
+		spi_soft_transfer(*s++);
+	}
+	spi_soft_deselect();
+	
+}
+
+/*************************************************************************
+Function: spi_soft_read()
+Purpose:  transmit 0x00 to read the number of bytes requested
+Input:    buffer receiving the bytes, numberOfBytes that want to be read
+Returns:  none
+**************************************************************************/
+void spi_soft_read(uint8_t *data, uint16_t numberOfBytes){
+	
+	spi_soft_select();
+	while (numberOfBytes--) {
+		*data++ = spi_soft_transfer(0x00);
+	}
+	spi_soft_deselect();
+	
+}
+#endif
+
+#if !defined (SPI_MINIMAL_ENABLED)
+/*************************************************************************
+Function: spi_rx_lost()
+Purpose:  Number of bytes dropped because the receive buffer was full
+Input:    None
+Returns:  Number of bytes lost since reset, wraps around
+**************************************************************************/
+uint16_t spi_rx_lost(void)
+{
+	uint16_t lost;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		lost = SPI_RxLost;
+	}
+	return lost;
+}
+#endif
+
+#if !defined (SPI_MINIMAL_ENABLED)
+/*************************************************************************
+Function: spi_tx_rejected()
+Purpose:  Number of bytes refused because the transmit buffer was full
+Input:    None
+Returns:  Number of bytes rejected since reset, wraps around
+**************************************************************************/
+uint16_t spi_tx_rejected(void)
+{
+	uint16_t rejected;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		rejected = SPI_TxRejected;
+	}
+	return rejected;
+}
+#endif
+
+#if defined (SPI_TRACE_ENABLED)
+/*************************************************************************
+Function: spi_trace_read()
+Purpose:  Pop the oldest byte of the bus trace
+Input:    entry to fill
+Returns:  1 if an entry was read, 0 if the trace is empty
+**************************************************************************/
+uint8_t spi_trace_read(struct spi_trace_entry *entry)
+{
+	uint8_t tmptail;
+	uint8_t read=0;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if (SPI_TraceHead != SPI_TraceTail) {
+			tmptail = (SPI_TraceTail + 1) & SPI_TRACE_MASK;
+			*entry = SPI_Trace[tmptail];
+			SPI_TraceTail = tmptail;
+			read=1;
+		}
+	}
+	return read;
+}
+#endif
+
+#if defined (SPI_EVENTS_ENABLED)
+/*************************************************************************
+Function: spi_event_register()
+Purpose:  Set the callback of an event
+Input:    event SPI_EVENT_x, callback or 0, deferred to spi_events_run() if 1
+Returns:  None
+**************************************************************************/
+void spi_event_register(uint8_t event, spi_event_callback callback, uint8_t deferred)
+{
+	uint8_t index=0;
+	
+	while (index < SPI_EVENT_COUNT && !(event & (1<<index))) {
+		index++;
+	}
+	if (index == SPI_EVENT_COUNT) {
+		return;
+	}
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		SPI_EventCallback[index] = callback;
+		if (deferred) {
+			SPI_EventDeferred |= (1<<index);
+		} else {
+			SPI_EventDeferred &= ~(1<<index);
+		}
+		SPI_EventPending &= ~(1<<index);
+	}
+}
+
+/*************************************************************************
+Function: spi_event_threshold()
+Purpose:  Set the number of received bytes raising SPI_EVENT_RX_THRESHOLD
+Input:    number of bytes, 0 disables the event
+Returns:  None
+**************************************************************************/
+void spi_event_threshold(uint16_t bytes)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		SPI_EventThreshold = bytes;
+	}
+}
+
+/*************************************************************************
+Function: spi_events_run()
+Purpose:  Run the callbacks of the deferred events raised since last call
+Input:    None
+Returns:  None
+**************************************************************************/
+void spi_events_run(void)
+{
+	uint8_t pending;
+	uint8_t index;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		pending = SPI_EventPending;
+		SPI_EventPending = 0;
+	}
+	
+	for (index=0; pending; index++, pending >>= 1) {
+		if ((pending & 0x01) && SPI_EventCallback[index]) {
+			SPI_EventCallback[index](1<<index);
+		}
+	}
+}
+#endif
\ No newline at end of file
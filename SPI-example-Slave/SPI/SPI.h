@@ -52,18 +52,105 @@ LICENSE:
 /* Constants and macros                                                 */
 /************************************************************************/
 
-/* SPI Mode */
+/* SPI Mode, may also be given to the compiler (-DSPI_SLAVE_ENABLED) */
+#if !defined (SPI_MASTER_ENABLED) && !defined (SPI_SLAVE_ENABLED)
 //#define SPI_MASTER_ENABLED
 #define SPI_SLAVE_ENABLED
+#endif
 
 /* Set size of receive and transmit buffers */
 
 #ifndef SPI_RX_BUFFER_SIZE
-#define SPI_RX_BUFFER_SIZE 64 /**< Size of the circular receive buffer, must be power of 2 */
+#define SPI_RX_BUFFER_SIZE 64 /**< Size of the circular receive buffer, must be power of 2, up to 32768 */
 #endif
 
 #ifndef SPI_TX_BUFFER_SIZE
-#define SPI_TX_BUFFER_SIZE 64 /**< Size of the circular transmit buffer, must be power of 2 */
+#define SPI_TX_BUFFER_SIZE 64 /**< Size of the circular transmit buffer, must be power of 2, up to 32768 */
+#endif
+
+/* Batching, small writes queued close together share one SS assertion (master) */
+//#define SPI_BATCH_ENABLED
+
+#ifndef SPI_BATCH_WINDOW
+#define SPI_BATCH_WINDOW 2 /**< spi_master_tick() calls the first held byte waits for more */
+#endif
+
+#ifndef SPI_BATCH_THRESHOLD
+#define SPI_BATCH_THRESHOLD (SPI_TX_BUFFER_SIZE / 2) /**< Held bytes start at once from this count */
+#endif
+
+/* Transaction timeouts, abort driven by spi_master_tick() (master) */
+//#define SPI_TIMEOUT_ENABLED
+
+#ifndef SPI_TIMEOUT_TICKS
+#define SPI_TIMEOUT_TICKS 4 /**< spi_master_tick() calls without a byte completed before the abort */
+#endif
+
+/* Read-ahead for slaves with sequential-read protocols (FIFO, flash) */
+//#define SPI_READAHEAD_ENABLED
+
+#ifndef SPI_READAHEAD_HIGH_WATER
+#define SPI_READAHEAD_HIGH_WATER (SPI_RX_BUFFER_SIZE - 8) /**< Read-ahead pauses when the receive buffer holds this many bytes */
+#endif
+
+#ifndef SPI_READAHEAD_LOW_WATER
+#define SPI_READAHEAD_LOW_WATER (SPI_RX_BUFFER_SIZE / 2) /**< Read-ahead resumes when spi_getc() brings it down to this */
+#endif
+
+/* Bridge, the slave forwards the received bytes to USART0 from the interrupts */
+//#define SPI_BRIDGE_ENABLED
+
+#ifndef SPI_BRIDGE_HIGH_WATER
+#define SPI_BRIDGE_HIGH_WATER (SPI_RX_BUFFER_SIZE / 2) /**< Slave answers SPI_BRIDGE_FILLER_BUSY from this many bytes waiting */
+#endif
+
+#ifndef SPI_BRIDGE_FILLER_READY
+#define SPI_BRIDGE_FILLER_READY 0x00 /**< Byte sent to the master while the bridge keeps up */
+#endif
+
+#ifndef SPI_BRIDGE_FILLER_BUSY
+#define SPI_BRIDGE_FILLER_BUSY 0xFF /**< Byte sent to the master when it must wait */
+#endif
+
+/* Minimal RAM configuration: no ringbuffers, caller buffers only */
+//#define SPI_MINIMAL_ENABLED
+
+/* Scatter-gather transfers on the hardware SPI master */
+//#define SPI_SG_ENABLED
+
+/* Register map answered by the slave interrupt, uses the SS pin change interrupt */
+//#define SPI_REGMAP_ENABLED
+
+/* Latency instrumentation, costs nothing when not enabled */
+//#define SPI_LATENCY_ENABLED
+
+/* Event callbacks, run from the interrupt or deferred to the main loop */
+//#define SPI_EVENTS_ENABLED
+
+/* Bus trace recorder, bytes exchanged by the interrupt with timestamps */
+//#define SPI_TRACE_ENABLED
+
+#ifndef SPI_TRACE_SIZE
+#define SPI_TRACE_SIZE 32 /**< Number of bytes kept in the trace, must be power of 2 up to 256 */
+#endif
+
+/* Bus profiler, bytes, transactions and busy time per slave and idle gaps (master) */
+//#define SPI_PROFILE_ENABLED
+
+#ifndef SPI_PROFILE_SLAVES
+#define SPI_PROFILE_SLAVES 4 /**< Number of slaves told apart by the profiler, see spi_profile_slave() */
+#endif
+
+#ifndef SPI_LATENCY_TIMER
+#define SPI_LATENCY_TIMER TCNT1 /**< Free-running 16-bit timer used for latency and trace timestamps, started by the application */
+#endif
+
+#ifndef SPI_LATENCY_BUCKETS
+#define SPI_LATENCY_BUCKETS 8 /**< Number of histogram buckets, the last one collects every longer latency */
+#endif
+
+#ifndef SPI_LATENCY_SHIFT
+#define SPI_LATENCY_SHIFT 4 /**< Bucket 0 holds latencies below 2^SHIFT ticks, each next bucket doubles */
 #endif
 
 /* SPI Mode */
@@ -73,7 +160,7 @@ LICENSE:
 #define SPI_MODE2 0x08
 #define SPI_MODE3 0x0C
 
-/* SPI Clock */
+/* SPI Clock, bit 2 selects SPI2X */
 
 #define SPI_CLOCK_DIV4		0x00
 #define SPI_CLOCK_DIV16		0x01
@@ -83,6 +170,66 @@ LICENSE:
 #define SPI_CLOCK_DIV8		0x05
 #define SPI_CLOCK_DIV32		0x06
 
+/* Clock planner, resolved at compile time from F_CPU */
+
+/** Divider of a SPI_CLOCK_DIVx setting */
+#define SPI_CLOCK_DIVIDER(clock)	( (clock) == SPI_CLOCK_DIV2 ? 2UL : (clock) == SPI_CLOCK_DIV4 ? 4UL : \
+									  (clock) == SPI_CLOCK_DIV8 ? 8UL : (clock) == SPI_CLOCK_DIV16 ? 16UL : \
+									  (clock) == SPI_CLOCK_DIV32 ? 32UL : (clock) == SPI_CLOCK_DIV64 ? 64UL : 128UL )
+
+/** SCK frequency in Hz obtained with a SPI_CLOCK_DIVx setting */
+#define SPI_CLOCK_HZ(clock)			( F_CPU / SPI_CLOCK_DIVIDER(clock) )
+
+/** Fastest SPI_CLOCK_DIVx whose SCK does not exceed hz, fails to compile
+    ("size of unnamed array is negative") below F_CPU/128, in C and C++ */
+#define SPI_CLOCK_FOR(hz)			((uint8_t)( (F_CPU / 2UL <= (hz)) ? SPI_CLOCK_DIV2 : (F_CPU / 4UL <= (hz)) ? SPI_CLOCK_DIV4 : \
+									  (F_CPU / 8UL <= (hz)) ? SPI_CLOCK_DIV8 : (F_CPU / 16UL <= (hz)) ? SPI_CLOCK_DIV16 : \
+									  (F_CPU / 32UL <= (hz)) ? SPI_CLOCK_DIV32 : (F_CPU / 64UL <= (hz)) ? SPI_CLOCK_DIV64 : \
+									  SPI_CLOCK_DIV128 + 0 * sizeof(char[(F_CPU / 128UL <= (hz)) ? 1 : -1]) ))
+
+/* SPI Bit order */
+
+#define SPI_MSBFIRST		0x00
+#define SPI_LSBFIRST		0x20
+
+/* Pin access, pins are given as PORT letter, bit number (e.g. B, 4) */
+#define SPI_IO_HIGH_(port, bit)		(PORT##port |= (1<<(bit)))
+#define SPI_IO_LOW_(port, bit)		(PORT##port &= ~(1<<(bit)))
+#define SPI_IO_OUTPUT_(port, bit)	(DDR##port |= (1<<(bit)))
+#define SPI_IO_INPUT_(port, bit)	(DDR##port &= ~(1<<(bit)))
+#define SPI_IO_IS_HIGH_(port, bit)	(PIN##port & (1<<(bit)))
+
+#define SPI_IO_HIGH(pin)		SPI_IO_HIGH_(pin)
+#define SPI_IO_LOW(pin)			SPI_IO_LOW_(pin)
+#define SPI_IO_OUTPUT(pin)		SPI_IO_OUTPUT_(pin)
+#define SPI_IO_INPUT(pin)		SPI_IO_INPUT_(pin)
+#define SPI_IO_IS_HIGH(pin)		SPI_IO_IS_HIGH_(pin)
+
+/* Software SPI, bit-banged on any pins, independent of the hardware SPI */
+//#define SPI_SOFT_ENABLED
+
+/* Pins are given as PORT letter, bit number */
+#ifndef SPI_SOFT_SCK
+#define SPI_SOFT_SCK		D, 5
+#endif
+#ifndef SPI_SOFT_MOSI
+#define SPI_SOFT_MOSI		D, 6
+#endif
+#ifndef SPI_SOFT_MISO
+#define SPI_SOFT_MISO		D, 7
+#endif
+#ifndef SPI_SOFT_SS
+#define SPI_SOFT_SS			D, 4
+#endif
+
+#ifndef SPI_SOFT_MODE
+#define SPI_SOFT_MODE		SPI_MODE0		/**< SPI_MODEx (x : 0 -> 3) of the software bus */
+#endif
+
+#ifndef SPI_SOFT_BITORDER
+#define SPI_SOFT_BITORDER	SPI_MSBFIRST	/**< SPI_MSBFIRST or SPI_LSBFIRST */
+#endif
+
 /* Slave structure */
 struct spi_slave_info
 {
@@ -91,6 +238,92 @@ struct spi_slave_info
 	 uint8_t ddr;
 };
 
+/* Word byte order */
+#define SPI_WORD_BIG_ENDIAN		0x00	// Most significant byte first
+#define SPI_WORD_LITTLE_ENDIAN	0x01	// Least significant byte first
+
+/* Handle of an asynchronous transaction */
+typedef uint8_t spi_ticket;
+
+/* Protothread form of the wait, needs pt.h: suspends until the ticket is done */
+#define SPI_PT_WAIT(pt, ticket)	PT_WAIT_UNTIL(pt, spi_async_done(ticket))
+
+/* Bridge output, USART0 as UART or as SPI master (MSPIM), OR-ed with SPI_MODEx */
+#define SPI_BRIDGE_UART		0x00
+#define SPI_BRIDGE_MSPIM	0x80
+
+/* Scatter-gather segment flags */
+#define SPI_SEG_TX			0x01	// Send the segment bytes, 0x00 is sent otherwise
+#define SPI_SEG_RX			0x02	// Store the received bytes in the segment
+#define SPI_SEG_PGM			0x04	// Segment bytes are in flash, with SPI_SEG_TX only
+
+/* Scatter-gather segment */
+struct spi_segment
+{
+	const void *data;	// RAM or flash address, written when SPI_SEG_RX is set
+	uint16_t length;
+	uint8_t flags;		// SPI_SEG_x
+};
+
+/* Register map flags */
+#define SPI_REG_READONLY	0x01	// Writes from the master are ignored
+
+/* Register of the slave register map */
+struct spi_register
+{
+	uint8_t address;					// First address, 0x00 to 0x7F
+	uint8_t size;						// Number of bytes, consecutive addresses
+	uint8_t flags;						// SPI_REG_x
+	uint8_t *data;						// Register content
+	void (*on_write)(uint8_t address);	// Called from the interrupt once written, may be 0
+};
+
+/* Events */
+#define SPI_EVENT_RX_THRESHOLD	0x01	// Receive buffer reached the threshold
+#define SPI_EVENT_TX_DRAINED	0x02	// Last byte of the transmit buffer started
+#define SPI_EVENT_COMPLETE		0x04	// Transaction done, SS put high (master)
+#define SPI_EVENT_ERROR			0x08	// Byte lost, receive buffer full
+#define SPI_EVENT_TIMEOUT		0x10	// Transaction aborted by the timeout (master)
+#define SPI_EVENT_COUNT			5
+
+typedef void (*spi_event_callback)(uint8_t event);
+
+/* Bus trace entry */
+#define SPI_TRACE_END		0x01	// SS was put high after this byte (master)
+
+struct spi_trace_entry
+{
+	uint16_t time;		// SPI_LATENCY_TIMER when the byte completed
+	uint8_t sent;		// MOSI for the master, MISO for the slave
+	uint8_t received;	// MISO for the master, MOSI for the slave
+	uint8_t flags;		// SPI_TRACE_x
+};
+
+/* Latency histograms */
+struct spi_latency_stats
+{
+	uint16_t transaction[SPI_LATENCY_BUCKETS];	// SS low to SS high (master only)
+	uint16_t rx_queue[SPI_LATENCY_BUCKETS];		// byte stored by the ISR to byte read by spi_getc
+	uint16_t transaction_max;					// worst transaction latency, in timer ticks
+	uint16_t rx_queue_max;						// worst receive queue latency, in timer ticks
+};
+
+/* Bus profiler counters, times in SPI_LATENCY_TIMER ticks */
+struct spi_profile_slave
+{
+	uint32_t bytes;			// bytes exchanged, interrupt and polled paths
+	uint32_t busy;			// SS low (or bus acquired) to SS high (or released)
+	uint16_t transactions;	// transactions started
+};
+
+struct spi_profile_stats
+{
+	struct spi_profile_slave slave[SPI_PROFILE_SLAVES];
+	uint32_t idle;			// sum of the gaps between two transactions
+	uint16_t idle_max;		// longest gap
+	uint16_t gaps;			// number of gaps summed in idle
+};
+
 /************************************************************************/
 /* Functions prototype                                                  */
 /************************************************************************/
@@ -103,6 +336,20 @@ struct spi_slave_info
 */
 extern void spi_master_init(uint8_t mode, uint8_t clock);
 
+/**
+   @brief   Change mode, clock rate and bit order of the master
+   
+   Waits for the current transaction to end and applies SPCR and SPSR
+   together, so the next transaction starts with the new settings.
+   SPI_CLOCK_DIV2, DIV8 and DIV32 set SPI2X.
+
+   @param   mode SPI_MODEx (x : 0 -> 3)
+   @param   clock SPI_CLOCK_DIVx (x : 2, 4, 8, 16, 32, 64 or 128)
+   @param   bitorder SPI_MSBFIRST or SPI_LSBFIRST
+   @return  none
+*/
+extern void spi_master_settings(uint8_t mode, uint8_t clock, uint8_t bitorder);
+
 /**
    @brief   Initialize SPI in Slave Mode
    @param   none
@@ -110,6 +357,50 @@ extern void spi_master_init(uint8_t mode, uint8_t clock);
 */
 extern void spi_slave_init(void);
 
+#if defined (SPI_REGMAP_ENABLED)
+/**
+   @brief   Answer the master from a register map
+
+   Each frame (SS low to SS high) starts with a command byte: bit 7 set
+   for a read, cleared for a write, address on bits 6-0. The following
+   bytes read or write consecutive addresses, crossing registers, all
+   handled in the interrupt. Unmapped addresses read 0x00. The write
+   callback of a register runs when the frame leaves it or ends.
+   The master must leave the slave one interrupt latency between bytes.
+
+   @param   map registers, kept by the library
+   @param   count number of registers, 0 goes back to the ringbuffers
+   @return  none
+*/
+extern void spi_slave_regmap(const struct spi_register *map, uint8_t count);
+#endif
+
+#if defined (SPI_BRIDGE_ENABLED)
+/**
+   @brief   Forward the bytes received by the slave to USART0
+
+   Each byte stored by the SPI interrupt is taken out of the receive buffer
+   by the USART data register empty interrupt, the main loop is not in the
+   data path and must not call spi_getc() meanwhile. When nothing is queued
+   with spi_putc() the slave answers SPI_BRIDGE_FILLER_BUSY while
+   SPI_BRIDGE_HIGH_WATER bytes or more wait, SPI_BRIDGE_FILLER_READY
+   otherwise, so the master can hold off. In SPI_BRIDGE_MSPIM mode the
+   downstream chip select is left to the application.
+
+   @param   ubrr USART baud rate register value
+   @param   mode SPI_BRIDGE_UART, or SPI_BRIDGE_MSPIM | SPI_MODEx
+   @return  none
+*/
+extern void spi_bridge_start(uint16_t ubrr, uint8_t mode);
+
+/**
+   @brief   Stop forwarding, the next bytes stay in the receive buffer
+   @param   none
+   @return  none
+*/
+extern void spi_bridge_stop(void);
+#endif
+
 /**
    @brief   Close SPI, flush and clear any received datas
    @param   none
@@ -117,25 +408,289 @@ extern void spi_slave_init(void);
 */
 extern void spi_close(void);
 
+#if defined (SPI_MINIMAL_ENABLED)
+/**
+ *  @brief   Exchange bytes straight from and into the caller buffers
+ *
+ *  Minimal configuration only. Returns at once, the interrupt moves the
+ *  bytes under one SS assertion and spi_master_busy() tells the end.
+ *
+ *  @param   tx bytes to send, 0 to send 0x00
+ *  @param   rx buffer for the received bytes, 0 to drop them
+ *  @param   numberOfBytes to exchange
+ *  @return  1 if started, 0 if the bus is busy
+ */
+extern uint8_t spi_master_transfer(const uint8_t *tx, uint8_t *rx, uint16_t numberOfBytes);
+
+/**
+ *  @brief   Arm the caller buffers for the next bytes clocked by the master
+ *
+ *  Minimal configuration only. Bytes beyond numberOfBytes answer 0x00
+ *  and are dropped.
+ *
+ *  @param   tx bytes to answer, 0 to answer 0x00
+ *  @param   rx buffer for the received bytes, 0 to drop them
+ *  @param   numberOfBytes to exchange
+ *  @return  none
+ */
+extern void spi_slave_transfer(const uint8_t *tx, uint8_t *rx, uint16_t numberOfBytes);
+
+/**
+ *  @brief   Tell if the armed buffers still wait for bytes
+ *  @return  1 if busy, 0 once every byte has been exchanged
+ */
+extern uint8_t spi_slave_busy(void);
+#else
 /**
  *  @brief   Put string to ringbuffer for transmitting via SPI & start transmission
  *			 Stop when nothing more to transmit
+ *
+ *  The string is queued in one piece, or not at all if the ringbuffer has
+ *  not enough room, as with spi_write(). A string refused this way is
+ *  added to spi_tx_rejected() and its ticket is done at once, compare
+ *  spi_tx_rejected() before and after the call to tell, or split strings
+ *  longer than SPI_TX_BUFFER_SIZE-1.
+ *
  *  @param   s string to be transmitted
- *  @return  none
+ *  @return  ticket to give to spi_async_done(), the call itself never waits
  */
-extern void spi_master_transmit(const char *s);
+extern spi_ticket spi_master_transmit(const char *s);
 
 /**
  *  @brief   Read x bytes from the slave
+ *
+ *  When a transaction is in flight the bytes are read after the ones
+ *  already queued, in the same SS window.
+ *
  *  @param   numberOfBytes to read from the slave
+ *  @return  ticket to give to spi_async_done(), the call itself never waits
+ */
+extern spi_ticket spi_master_read(uint16_t numberOfBytes);
+
+/**
+ *  @brief   Tell if the transaction of a ticket has ended
+ *
+ *  Several tasks can queue transfers and each one waits on its own ticket,
+ *  sharing the ringbuffers. With protothreads: SPI_PT_WAIT(pt, ticket).
+ *
+ *  @param   ticket returned by spi_master_transmit() or spi_master_read()
+ *  @return  1 if done, 0 if still queued or running
+ */
+extern uint8_t spi_async_done(spi_ticket ticket);
+
+#if defined (SPI_BATCH_ENABLED) || defined (SPI_TIMEOUT_ENABLED)
+/**
+ *  @brief   Periodic work of the master, called from a timer or the main loop
+ *
+ *  With SPI_BATCH_ENABLED, a write to an idle bus is held instead of pulling
+ *  SS low, so that the next writes join the same SS assertion. The held bytes
+ *  start after SPI_BATCH_WINDOW calls, at SPI_BATCH_THRESHOLD bytes, or with
+ *  spi_master_flush(). Only for slaves whose protocol accepts several
+ *  commands in one SS assertion.
+ *
+ *  With SPI_TIMEOUT_ENABLED, a transaction without any byte completed for
+ *  the timeout ticks is aborted, see spi_master_timeout().
+ *
  *  @return  none
  */
-extern void spi_master_read(uint8_t numberOfBytes);
+extern void spi_master_tick(void);
+#endif
+
+#if defined (SPI_BATCH_ENABLED)
+
+/**
+ *  @brief   Start the held bytes now, for ordering points
+ *
+ *  spi_master_read(), spi_master_acquire() and the segment lists flush by
+ *  themselves.
+ *
+ *  @return  ticket of the transaction sending them
+ */
+extern spi_ticket spi_master_flush(void);
+#endif
+
+#if defined (SPI_TIMEOUT_ENABLED)
+/**
+ *  @brief   Set the timeout policy of the next transactions
+ *
+ *  On timeout SS is put high and the rest of the transaction is dropped:
+ *  the byte in flight, the bytes still queued and the pending reads. Sending
+ *  the remaining bytes alone would give the slave a truncated command, so
+ *  the application decides what to send again. Waiting tickets end,
+ *  SPI_EVENT_TIMEOUT is raised and spi_timeouts() counts it. Called before
+ *  talking to a slave, it gives each slave its own policy.
+ *
+ *  @param   ticks spi_master_tick() calls without a byte completed, 0 disables
+ *  @return  none
+ */
+extern void spi_master_timeout(uint8_t ticks);
+
+/**
+ *  @brief   End the running transaction now and drop the queued bytes
+ *
+ *  A polled session between spi_master_acquire() and spi_master_release()
+ *  is not interrupted.
+ *
+ *  @return  none
+ */
+extern void spi_master_abort(void);
+
+/**
+ *  @brief   Return number of transactions aborted on timeout
+ *  @return  timeouts since reset, wraps around
+ */
+extern uint16_t spi_timeouts(void);
+#endif
+
+#if defined (SPI_READAHEAD_ENABLED)
+/**
+ *  @brief   Read ahead from a sequential slave
+ *
+ *  Once the queued bytes (e.g. a read command) are sent, the interrupt
+ *  keeps clocking 0x00 into the receive buffer with SS low, pausing at
+ *  SPI_READAHEAD_HIGH_WATER bytes and resuming from spi_getc() at
+ *  SPI_READAHEAD_LOW_WATER, so the data is in RAM before it is asked for.
+ *
+ *  @return  ticket of the transaction, done after spi_master_stream_stop()
+ */
+extern spi_ticket spi_master_stream_start(void);
+
+/**
+ *  @brief   Stop reading ahead and put SS high, received bytes stay available
+ *  @return  none
+ */
+extern void spi_master_stream_stop(void);
+#endif
+#endif
+
+#if defined (SPI_SG_ENABLED)
+/**
+ *  @brief   Run a list of segments back-to-back under one SS assertion
+ *
+ *  Segments are executed by the interrupt straight from and into the
+ *  caller buffers, without going through the ringbuffers. The segments
+ *  and their buffers must stay valid until spi_master_busy() returns 0.
+ *
+ *  @param   segments list of segments
+ *  @param   count number of segments
+ *  @return  1 if started, 0 if the bus is busy
+ */
+extern uint8_t spi_master_transfer_segments(const struct spi_segment *segments, uint8_t count);
+#endif
+
+/**
+ *  @brief   Take the bus for polled transfers
+ *
+ *  Waits for the current transaction to end, then disables the SPI
+ *  interrupt so that a driver can run tight polled loops. Slave select
+ *  is left to the driver. Mode, clock and bit order are saved and
+ *  restored by spi_master_release().
+ *
+ *  @return  none
+ */
+extern void spi_master_acquire(void);
+
+/**
+ *  @brief   Take the bus as spi_master_acquire(), then apply the settings
+ *           of the device, restored by spi_master_release()
+ *  @param   mode SPI_MODEx (x : 0 -> 3)
+ *  @param   clock SPI_CLOCK_DIVx (x : 2, 4, 8, 16, 32, 64 or 128)
+ *  @param   bitorder SPI_MSBFIRST or SPI_LSBFIRST
+ *  @return  none
+ */
+extern void spi_master_acquire_settings(uint8_t mode, uint8_t clock, uint8_t bitorder);
+
+/**
+ *  @brief   Give the bus back to the interrupt driven transfers, with the
+ *           settings it had when acquired
+ *
+ *  Bytes queued with spi_master_transmit() or spi_master_read() during
+ *  the session start now, their tickets are done once they went out.
+ *
+ *  @return  none
+ */
+extern void spi_master_release(void);
+
+/**
+ *  @brief   Change the clock rate, the mode is kept
+ *  @param   clock SPI_CLOCK_DIVx (x : 2, 4, 8, 16, 32, 64 or 128)
+ *  @return  none
+ */
+extern void spi_master_set_clock(uint8_t clock);
+
+/**
+ *  @brief   Polled exchange of one byte, the bus must be acquired
+ *  @param   data byte to be transmitted
+ *  @return  byte received from the slave
+ */
+extern uint8_t spi_master_exchange(uint8_t data);
+
+/**
+ *  @brief   Polled read of a block, the bus must be acquired
+ *
+ *  The next byte is started right after the previous one is read, the
+ *  store happens while it is shifted out.
+ *
+ *  @param   data buffer receiving the bytes
+ *  @param   numberOfBytes to read
+ *  @param   filler byte sent while reading
+ *  @return  none
+ */
+extern void spi_master_read_block(uint8_t *data, uint16_t numberOfBytes, uint8_t filler);
+
+/**
+ *  @brief   Polled write of a block, the bus must be acquired
+ *  @param   data bytes to be transmitted
+ *  @param   numberOfBytes to write
+ *  @return  none
+ */
+extern void spi_master_write_block(const uint8_t *data, uint16_t numberOfBytes);
+
+/**
+ *  @brief   Polled exchange of a 16, 24 or 32-bit word, the bus must be acquired
+ *  @param   word to be transmitted
+ *  @param   size in bytes, 1 to 4
+ *  @param   order SPI_WORD_BIG_ENDIAN or SPI_WORD_LITTLE_ENDIAN, both directions
+ *  @return  word received
+ */
+extern uint32_t spi_master_exchange_word(uint32_t word, uint8_t size, uint8_t order);
+
+/**
+ *  @brief   Polled read of an array of words, the bus must be acquired
+ *
+ *  Words are uint16_t for size 2 and uint32_t for size 3 or 4. 0x00 is sent
+ *  meanwhile and the next byte starts before the previous one is stored,
+ *  as with spi_master_read_block(), for sample streaming from ADCs.
+ *
+ *  @param   words array receiving the words
+ *  @param   count number of words
+ *  @param   size in bytes, 1 to 4
+ *  @param   order SPI_WORD_BIG_ENDIAN or SPI_WORD_LITTLE_ENDIAN
+ *  @return  none
+ */
+extern void spi_master_read_words(void *words, uint16_t count, uint8_t size, uint8_t order);
+
+/**
+ *  @brief   Polled write of an array of words, the bus must be acquired
+ *  @param   words array of uint16_t for size 2, uint32_t for size 3 or 4
+ *  @param   count number of words
+ *  @param   size in bytes, 1 to 4
+ *  @param   order SPI_WORD_BIG_ENDIAN or SPI_WORD_LITTLE_ENDIAN
+ *  @return  none
+ */
+extern void spi_master_write_words(const void *words, uint16_t count, uint8_t size, uint8_t order);
+
+/**
+ *  @brief   Tell if a transaction is in progress (SS low)
+ *  @return  1 if busy, 0 if idle
+ */
+extern uint8_t spi_master_busy(void);
 
 //extern void spi_master_addSlave(spi_slave_info slave);
 
 //extern void spi_master_transmitToSlave(spi_slave_info slave, const char *s);
 
+#if !defined (SPI_MINIMAL_ENABLED)
 /**
  *  @brief   Get received byte from ringbuffer
  *
@@ -149,11 +704,51 @@ extern uint8_t spi_getc(void);
 
 /**
  *  @brief   Put byte to ringbuffer for transmitting via SPI
+ *
+ *  Safe to call from the main loop and from any interrupt at the same time,
+ *  no need to wrap it with cli()/sei(). A byte that does not fit is
+ *  dropped and counted by spi_tx_rejected().
+ *
  *  @param   data byte to be transmitted
  *  @return  none
  */
 extern void spi_putc(uint8_t data);
 
+/**
+ *  @brief   Put a block of bytes to ringbuffer for transmitting via SPI
+ *
+ *  The block is queued contiguously even when other interrupts enqueue
+ *  at the same time, or not at all if the ringbuffer has not enough room.
+ *  Safe to call from the main loop and from any interrupt.
+ *
+ *  @param   data bytes to be transmitted
+ *  @param   count number of bytes, at most SPI_TX_BUFFER_SIZE-1
+ *  @return  1 if queued, 0 if the ringbuffer is full
+ */
+extern uint8_t spi_write(const uint8_t *data, uint16_t count);
+
+/**
+ *  @brief   Put a 16, 24 or 32-bit word to ringbuffer, all or nothing
+ *
+ *  The bytes are queued with a single reservation, as with spi_write().
+ *
+ *  @param   word to be transmitted
+ *  @param   size in bytes, 1 to 4
+ *  @param   order SPI_WORD_BIG_ENDIAN or SPI_WORD_LITTLE_ENDIAN
+ *  @return  1 if queued, 0 if the ringbuffer is full
+ */
+extern uint8_t spi_write_word(uint32_t word, uint8_t size, uint8_t order);
+
+/**
+ *  @brief   Put an array of words to ringbuffer, all or nothing
+ *  @param   words array of uint16_t for size 2, uint32_t for size 3 or 4
+ *  @param   count number of words, count*size at most SPI_TX_BUFFER_SIZE-1
+ *  @param   size in bytes, 1 to 4
+ *  @param   order SPI_WORD_BIG_ENDIAN or SPI_WORD_LITTLE_ENDIAN
+ *  @return  1 if queued, 0 if the ringbuffer is full or count*size too large
+ */
+extern uint8_t spi_write_words(const void *words, uint16_t count, uint8_t size, uint8_t order);
+
 /**
  *  @brief   Put string to ringbuffer for transmitting via SPI
  *
@@ -172,9 +767,174 @@ extern void spi_puts(const char *s );
  */
 extern uint16_t spi_available(void);
 
+/**
+ *  @brief   Get a 16, 24 or 32-bit word from the receive buffer
+ *  @param   word filled with the word, upper bytes cleared
+ *  @param   size in bytes, 1 to 4
+ *  @param   order SPI_WORD_BIG_ENDIAN or SPI_WORD_LITTLE_ENDIAN
+ *  @return  1 if read, 0 if fewer than size bytes are waiting, none taken then
+ */
+extern uint8_t spi_read_word(uint32_t *word, uint8_t size, uint8_t order);
+
 /**
  *  @brief   Flush bytes waiting in receive buffer
  */
 extern void spi_flush(void);
 
+/**
+ *  @brief   Return number of bytes dropped because the receive buffer was full
+ *  @return  bytes lost since reset, wraps around
+ */
+extern uint16_t spi_rx_lost(void);
+
+/**
+ *  @brief   Return number of bytes refused because the transmit buffer was
+ *           full, by spi_putc(), spi_write() and the functions built on them
+ *  @return  bytes rejected since reset, wraps around
+ */
+extern uint16_t spi_tx_rejected(void);
+#endif
+
+#if defined (SPI_EVENTS_ENABLED)
+/**
+ *  @brief   Set the callback of an event
+ *
+ *  An immediate callback runs inside the SPI interrupt and must be short.
+ *  A deferred callback runs from spi_events_run() in the main loop, once
+ *  however many times the event was raised since the previous run.
+ *
+ *  @param   event SPI_EVENT_x
+ *  @param   callback function receiving the event, 0 to remove it
+ *  @param   deferred 1 to run it from spi_events_run(), 0 from the interrupt
+ *  @return  none
+ */
+extern void spi_event_register(uint8_t event, spi_event_callback callback, uint8_t deferred);
+
+/**
+ *  @brief   Set the number of bytes waiting in the receive buffer raising SPI_EVENT_RX_THRESHOLD
+ *  @param   bytes threshold, 0 disables the event
+ *  @return  none
+ */
+extern void spi_event_threshold(uint16_t bytes);
+
+/**
+ *  @brief   Run the deferred callbacks of the events raised since last call
+ *  @return  none
+ */
+extern void spi_events_run(void);
+#endif
+
+#if defined (SPI_TRACE_ENABLED)
+/**
+ *  @brief   Pop the oldest entry of the bus trace
+ *
+ *  The interrupt records every byte it handles, overwriting the oldest
+ *  entry when the trace is full. Polled transfers are not recorded.
+ *
+ *  @param   entry filled with the oldest byte
+ *  @return  1 if an entry was read, 0 if the trace is empty
+ */
+extern uint8_t spi_trace_read(struct spi_trace_entry *entry);
+#endif
+
+#if defined (SPI_SOFT_ENABLED)
+/**
+ *  @brief   Initialize the software SPI pins, SS high and SCK idle
+ *
+ *  Each clock edge is a single sbi/cbi and each sample a single sbic when
+ *  the pins sit in the low I/O space (PORTA to PORTD). A byte costs about
+ *  12 CPU cycles per bit, roughly F_CPU/12 SCK against F_CPU/2 for the
+ *  hardware SPI. Transfers are polled and interrupts stay enabled.
+ *
+ *  @return  none
+ */
+extern void spi_soft_init(void);
+
+/**
+ *  @brief   Pull the software SPI SS line low
+ *  @return  none
+ */
+extern void spi_soft_select(void);
+
+/**
+ *  @brief   Release the software SPI SS line
+ *  @return  none
+ */
+extern void spi_soft_deselect(void);
+
+/**
+ *  @brief   Exchange one byte on the software SPI, SS is left untouched
+ *  @param   data byte to be transmitted
+ *  @return  byte received from the slave
+ */
+extern uint8_t spi_soft_transfer(uint8_t data);
+
+/**
+ *  @brief   Transmit a string on the software SPI in one SS window
+ *  @param   s string to be transmitted
+ *  @return  none
+ */
+extern void spi_soft_transmit(const char *s);
+
+/**
+ *  @brief   Read bytes from the software SPI slave in one SS window
+ *  @param   data buffer receiving the bytes
+ *  @param   numberOfBytes to read from the slave
+ *  @return  none
+ */
+extern void spi_soft_read(uint8_t *data, uint16_t numberOfBytes);
+#endif
+
+#if defined (SPI_LATENCY_ENABLED)
+/**
+ *  @brief   Copy the latency histograms collected so far
+ *
+ *  Bucket 0 counts latencies below 2^SPI_LATENCY_SHIFT timer ticks, bucket n
+ *  counts latencies below 2^(SPI_LATENCY_SHIFT+n) ticks and the last bucket
+ *  counts everything above. Counters saturate at 0xFFFF.
+ *
+ *  @param   stats structure filled with a consistent snapshot
+ *  @return  none
+ */
+extern void spi_latency_dump(struct spi_latency_stats *stats);
+
+/**
+ *  @brief   Clear the latency histograms
+ *  @return  none
+ */
+extern void spi_latency_reset(void);
+#endif
+
+#if defined (SPI_MASTER_ENABLED) && defined (SPI_PROFILE_ENABLED)
+/**
+ *  @brief   Account the next transactions to a slave
+ *
+ *  The slave is latched when a transaction starts (or the bus is acquired),
+ *  call it before queuing the bytes of each device. Ignored when out of range.
+ *
+ *  @param   slave number, 0 to SPI_PROFILE_SLAVES-1
+ *  @return  none
+ */
+extern void spi_profile_slave(uint8_t slave);
+
+/**
+ *  @brief   Copy the bus counters collected so far
+ *
+ *  Meant to be called periodically: the busy times against the period give
+ *  the bus share of each slave, idle and idle_max show the gaps between SS
+ *  high and the next transaction. A single gap longer than the timer period
+ *  is counted modulo 65536 ticks.
+ *
+ *  @param   stats structure filled with a consistent snapshot
+ *  @return  none
+ */
+extern void spi_profile_dump(struct spi_profile_stats *stats);
+
+/**
+ *  @brief   Clear the bus counters
+ *  @return  none
+ */
+extern void spi_profile_reset(void);
+#endif
+
 #endif /* SPI_H_ */
\ No newline at end of file
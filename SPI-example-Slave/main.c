@@ -21,7 +21,9 @@ LICENSE:
 	GNU General Public License for more details.
     
 ************************************************************************/
-#define F_CPU 8000000UL
+#ifndef F_CPU
+#define F_CPU 8000000UL	// also given in the project symbols, for the library files
+#endif
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
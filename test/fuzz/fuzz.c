@@ -0,0 +1,392 @@
+/*************************************************************************
+
+	Seeded fuzz of the interleaving of the API calls with the interrupt
+
+	The application side calls spi_master_transmit(), spi_write(),
+	spi_master_read(), spi_getc(), runs polled sessions between
+	spi_master_acquire() and spi_master_release() queuing bytes meanwhile
+	and, with SPI_BATCH_ENABLED,
+	spi_master_tick() and spi_master_flush() in a random order. The
+	interrupt runs between the calls and at every exit of an ATOMIC_BLOCK
+	of the library (sim_irq_exit), the points where a pending interrupt
+	runs on the MCU. The slave answers a byte counter, never more bytes
+	than the receive buffer can take.
+
+	Checked at every byte and at the end:
+	- MOSI without the 0x00 fillers is every byte queued, in order
+	- the fillers are the bytes read, never more
+	- the receive buffer gives back the counter without a gap, nothing lost
+	- every ticket is done once the bus is idle, and not before: a ticket
+	  taken during a polled session waits for spi_master_release()
+	- a string longer than the ring is rejected whole, counted by
+	  spi_tx_rejected(), none of its bytes on MOSI
+
+	The report gives the bytes per transaction and the host cycles per
+	interrupt, to be compared with the previous runs. The same seed gives
+	the same run.
+
+	usage: fuzz [seed [calls]]
+
+*************************************************************************/
+
+#include "SPI.c"
+#include "wire.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define FUZZ_EXPECTED_SIZE	(1UL << 20)
+
+static uint32_t fuzz_state;
+static uint8_t fuzz_expected[FUZZ_EXPECTED_SIZE];	// bytes queued, in order
+static uint32_t fuzz_queued, fuzz_sent;				// written / checked in fuzz_expected
+static uint32_t fuzz_requested, fuzz_fillers;		// bytes read / fillers clocked
+static uint8_t fuzz_miso, fuzz_rx;					// counters of the slave and the application
+static uint32_t fuzz_received;
+static spi_ticket fuzz_ticket;						// last ticket returned
+static int fuzz_errors;
+
+/*************************************************************************
+Function: fuzz_random()
+Purpose:  xorshift generator, the same seed gives the same run
+Input:    upper bound
+Returns:  number from 0 to bound - 1
+**************************************************************************/
+static uint32_t fuzz_random(uint32_t bound){
+	
+	fuzz_state ^= fuzz_state << 13;
+	fuzz_state ^= fuzz_state >> 17;
+	fuzz_state ^= fuzz_state << 5;
+	return fuzz_state % bound;
+}
+
+/*************************************************************************
+Function: fuzz_fail()
+Purpose:  report a failed check, stops after a few
+Input:    message, value found, value expected
+Returns:  none
+**************************************************************************/
+static void fuzz_fail(const char *message, unsigned long found, unsigned long expected){
+	
+	printf("byte %u: %s, %lu instead of %lu\n", wire_bytes, message, found, expected);
+	if (++fuzz_errors >= 10) {
+		exit(1);
+	}
+}
+
+/*************************************************************************
+Function: fuzz_clock()
+Purpose:  clock bytes in flight while the receive buffer has room
+Input:    maximum number of bytes
+Returns:  none
+**************************************************************************/
+static void fuzz_clock(uint32_t count){
+	
+	uint8_t mosi;
+	
+	// the room is read from the indexes: spi_available() would be a
+	// firing point of its own with 16-bit indexes
+	while (count-- && wire_master_busy() &&
+		((SPI_RxHead - SPI_RxTail) & SPI_RX_BUFFER_MASK) < SPI_RX_BUFFER_MASK) {
+		mosi = wire_master_clock(fuzz_miso++);
+		if (mosi == 0x00) {
+			if (++fuzz_fillers > fuzz_requested) {
+				fuzz_fail("more fillers than bytes read", fuzz_fillers, fuzz_requested);
+			}
+		}
+		else if (fuzz_sent >= fuzz_queued) {
+			fuzz_fail("byte sent that was never queued", mosi, 0);
+		}
+		else if (mosi != fuzz_expected[fuzz_sent++ % FUZZ_EXPECTED_SIZE]) {
+			fuzz_fail("byte sent out of order", mosi, fuzz_expected[(fuzz_sent - 1) % FUZZ_EXPECTED_SIZE]);
+		}
+	}
+}
+
+/*************************************************************************
+Function: fuzz_interrupt()
+Purpose:  firing point at the end of an ATOMIC_BLOCK of the library
+Input:    none
+Returns:  none
+**************************************************************************/
+static void fuzz_interrupt(void){
+	
+	if (fuzz_random(4) == 0) {
+		fuzz_clock(1);
+	}
+}
+
+/*************************************************************************
+Function: fuzz_room()
+Purpose:  free room of the transmit ringbuffer, an interrupt can only grow it
+Input:    none
+Returns:  bytes
+**************************************************************************/
+static uint16_t fuzz_room(void){
+	
+	uint16_t used;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		used = (SPI_TxHead - SPI_TxTail) & SPI_TX_BUFFER_MASK;
+	}
+	return SPI_TX_BUFFER_MASK - used;
+}
+
+/*************************************************************************
+Function: fuzz_drain()
+Purpose:  take received bytes, checking the counter of the slave
+Input:    maximum number of bytes
+Returns:  none
+**************************************************************************/
+static void fuzz_drain(uint32_t count){
+	
+	uint8_t data;
+	
+	while (count-- && spi_available()) {
+		data = spi_getc();
+		if (data != fuzz_rx) {
+			fuzz_fail("received byte out of sequence", data, fuzz_rx);
+		}
+		fuzz_rx = data + 1;
+		fuzz_received++;
+	}
+}
+
+/*************************************************************************
+Function: fuzz_settle()
+Purpose:  clock and take the bytes until the transaction is over
+Input:    none
+Returns:  none
+**************************************************************************/
+static void fuzz_settle(void){
+	
+	while (wire_master_busy()) {
+		fuzz_drain(SPI_RX_BUFFER_SIZE);
+		fuzz_clock(SPI_RX_BUFFER_SIZE);
+	}
+}
+
+/*************************************************************************
+Function: fuzz_transmit()
+Purpose:  spi_master_transmit() of a random string that fits the ring, now
+          and then of one longer than the ring that must be rejected whole
+Input:    none
+Returns:  1 if a string was queued
+**************************************************************************/
+static uint8_t fuzz_transmit(void){
+	
+	char text[SPI_TX_BUFFER_SIZE + 8];
+	uint16_t length, i, rejected;
+	
+	if (fuzz_random(32) == 0) {
+		length = SPI_TX_BUFFER_SIZE + fuzz_random(8);
+		memset(text, 'z', length);
+		text[length] = 0;
+		rejected = spi_tx_rejected();
+		spi_master_transmit(text);
+		if ((uint16_t)(spi_tx_rejected() - rejected) != length) {
+			fuzz_fail("string too long not counted as rejected", spi_tx_rejected() - rejected, length);
+		}
+		return 0;
+	}
+	length = 1 + fuzz_random(SPI_TX_BUFFER_MASK < 40 ? SPI_TX_BUFFER_MASK : 40);
+	if (length > fuzz_room()) {
+		return 0;
+	}
+	for (i = 0; i < length; i++) {
+		text[i] = 'A' + fuzz_random(26);
+		fuzz_expected[(fuzz_queued + i) % FUZZ_EXPECTED_SIZE] = text[i];
+	}
+	text[length] = 0;
+	fuzz_queued += length;
+	fuzz_ticket = spi_master_transmit(text);
+	return 1;
+}
+
+/*************************************************************************
+Function: fuzz_read()
+Purpose:  spi_master_read() of a random count
+Input:    none
+Returns:  number of bytes asked for
+**************************************************************************/
+static uint16_t fuzz_read(void){
+	
+	uint16_t length;
+	
+	// the application reads what it asked for before asking much more
+	if (fuzz_requested - fuzz_fillers > 2 * SPI_RX_BUFFER_SIZE) {
+		return 0;
+	}
+	length = fuzz_random(24);
+	fuzz_requested += length;
+	fuzz_ticket = spi_master_read(length);
+	return length;
+}
+
+/*************************************************************************
+Function: fuzz_session()
+Purpose:  polled session of a driver while the application queues bytes,
+          their tickets must wait for spi_master_release()
+Input:    none
+Returns:  none
+**************************************************************************/
+static void fuzz_session(void){
+	
+	uint8_t calls = 1 + fuzz_random(4);
+	uint8_t queued = 0;
+	spi_ticket ticket = 0;
+	
+#if defined (SPI_BATCH_ENABLED)
+	spi_master_flush();
+#endif
+	fuzz_settle();
+	spi_master_acquire();
+	while (calls--) {
+		spi_master_exchange(fuzz_random(256));
+		if (fuzz_random(2) ? fuzz_transmit() : (fuzz_read() != 0)) {
+			ticket = fuzz_ticket;
+			queued = 1;
+		}
+	}
+	if (queued && spi_async_done(ticket)) {
+		fuzz_fail("ticket done before the end of the polled session", ticket, SPI_TxnDone);
+	}
+	spi_master_release();
+	fuzz_settle();
+	if (queued && !spi_async_done(ticket)) {
+		fuzz_fail("bytes of the polled session never sent", ticket, SPI_TxnDone);
+	}
+}
+
+/*************************************************************************
+Function: fuzz_call()
+Purpose:  one random call of the application
+Input:    none
+Returns:  none
+**************************************************************************/
+static void fuzz_call(void){
+	
+	uint8_t data[SPI_TX_BUFFER_SIZE];
+	uint16_t length, i;
+	
+	switch (fuzz_random(9)) {
+		case 0:
+			fuzz_transmit();
+			break;
+		case 1:
+			length = 1 + fuzz_random(SPI_TX_BUFFER_MASK + 8);
+			for (i = 0; i < length; i++) {
+				data[i % sizeof(data)] = 1 + fuzz_random(255);
+			}
+			if (length > SPI_TX_BUFFER_MASK || length > fuzz_room()) {
+				if (length > SPI_TX_BUFFER_MASK && spi_write(data, length)) {
+					fuzz_fail("more bytes queued than the ringbuffer holds", length, SPI_TX_BUFFER_MASK);
+				}
+				break;
+			}
+			for (i = 0; i < length; i++) {
+				fuzz_expected[fuzz_queued++ % FUZZ_EXPECTED_SIZE] = data[i];
+			}
+			if (!spi_write(data, length)) {
+				fuzz_fail("no room found for the bytes", length, fuzz_room());
+			}
+			break;
+		case 2:
+			fuzz_read();
+			break;
+		case 3:
+			fuzz_drain(fuzz_random(64));
+			break;
+		case 4:
+			if (fuzz_random(16) == 0) {
+				fuzz_session();
+			}
+			break;
+	#if defined (SPI_BATCH_ENABLED)
+		case 5:
+			spi_master_tick();
+			break;
+		case 6:
+			if (fuzz_random(4) == 0) {
+				fuzz_ticket = spi_master_flush();
+			}
+			break;
+	#endif
+		default:
+			if (fuzz_random(32) == 0) {
+				fuzz_settle();	// the bus goes idle now and then
+			} else {
+				fuzz_clock(fuzz_random(16));
+			}
+			break;
+	}
+}
+
+int main(int argc, char *argv[]){
+	
+	uint32_t calls = 200000, round;
+	uint64_t start, cycles;
+	
+	fuzz_state = argc > 1 ? strtoul(argv[1], 0, 0) : 1;
+	if (argc > 2) {
+		calls = strtoul(argv[2], 0, 0);
+	}
+	if (!fuzz_state) {
+		fuzz_state = 1;
+	}
+	
+	sim_reset();
+	wire_clear();
+	spi_master_init(SPI_MODE0, SPI_CLOCK_DIV4);
+	sim_irq_exit = fuzz_interrupt;
+	
+	start = sim_cycles();
+	for (round = 0; round < calls; round++) {
+		fuzz_call();
+		// the expected bytes are kept in a window of the stream
+		if (fuzz_queued - fuzz_sent > FUZZ_EXPECTED_SIZE - 2 * SPI_TX_BUFFER_SIZE) {
+			fuzz_fail("bytes never sent", fuzz_queued - fuzz_sent, 0);
+			break;
+		}
+	}
+	
+	// let everything out, the bytes of spi_write() go with the next call
+	fuzz_ticket = spi_master_transmit("");
+#if defined (SPI_BATCH_ENABLED)
+	fuzz_ticket = spi_master_flush();
+#endif
+	fuzz_settle();
+	fuzz_drain(SPI_RX_BUFFER_SIZE);
+	cycles = sim_cycles() - start;
+	sim_irq_exit = 0;
+	
+	if (fuzz_sent != fuzz_queued) {
+		fuzz_fail("queued bytes never sent", fuzz_queued - fuzz_sent, 0);
+	}
+	if (fuzz_fillers != fuzz_requested) {
+		fuzz_fail("bytes read never clocked", fuzz_requested - fuzz_fillers, 0);
+	}
+	if (fuzz_received != wire_bytes) {
+		fuzz_fail("bytes received", fuzz_received, wire_bytes);
+	}
+	if (spi_rx_lost()) {
+		fuzz_fail("bytes lost", spi_rx_lost(), 0);
+	}
+	if (!(SPI_PORT & (1<<SPI_PIN_SS))) {
+		fuzz_fail("SS still low at the end", 0, 1);
+	}
+	if (!spi_async_done(fuzz_ticket)) {
+		fuzz_fail("last ticket not done", fuzz_ticket, SPI_TxnDone);
+	}
+	
+	printf("seed %lu: %u calls, %u bytes (%u queued, %u read) in %u transactions, "
+		"%.1f bytes per transaction, host %.0f cycles per interrupt, %.0f per call\n",
+		argc > 1 ? strtoul(argv[1], 0, 0) : 1UL, calls, wire_bytes, fuzz_queued, fuzz_requested,
+		wire_transactions, wire_transactions ? (double)wire_bytes / wire_transactions : 0.0,
+		sim_isr_calls ? (double)sim_isr_cycles / sim_isr_calls : 0.0, (double)cycles / calls);
+	
+	if (fuzz_errors) {
+		printf("%d error(s)\n", fuzz_errors);
+		return 1;
+	}
+	return 0;
+}
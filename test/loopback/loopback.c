@@ -0,0 +1,211 @@
+/*************************************************************************
+	
+	Loopback of the master and slave examples over a simulated wire
+
+	Both roles of SPI.c run in one process, each from its own shared
+	object. For every clock divider the example exchange is checked byte
+	for byte ("HELLO WORLD" one way, "WORLD HELLO" the other, then the
+	10-byte reads), followed by a stress workload of random blocks both
+	ways. The report gives per divider:
+
+	- bytes/s on the AVR: each byte takes 8 * divider cycles, plus the
+	  master interrupt from SPIF to the next SPDR write, counted as
+	  LOOPBACK_AVR_ISR_CYCLES (an estimate, replace it with the figure
+	  measured on the target)
+	- the host cycles spent in each interrupt per byte, measured, to
+	  compare builds of the library against each other
+
+	Returns non-zero on any byte lost or changed.
+
+*************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "SPI.h"
+#include "node.h"
+
+#ifndef LOOPBACK_AVR_ISR_CYCLES
+#define LOOPBACK_AVR_ISR_CYCLES		60
+#endif
+
+#define LOOPBACK_ROUNDS		2000	// stress blocks per divider
+#define LOOPBACK_BLOCK		48		// largest stress block, fits both rings
+
+static const uint8_t loopback_clocks[] = {
+	SPI_CLOCK_DIV2, SPI_CLOCK_DIV4, SPI_CLOCK_DIV8, SPI_CLOCK_DIV16,
+	SPI_CLOCK_DIV32, SPI_CLOCK_DIV64, SPI_CLOCK_DIV128
+};
+
+static int loopback_errors;
+
+/*************************************************************************
+Function: loopback_run()
+Purpose:  clock the bytes started by the master through both sides
+Input:    none
+Returns:  number of bytes exchanged
+**************************************************************************/
+static uint32_t loopback_run(void){
+	
+	uint32_t count = 0;
+	uint8_t mosi, miso;
+	
+	while (master_busy()) {
+		slave_select(1);
+		mosi = master_mosi();
+		miso = slave_miso();
+		slave_clock(mosi);
+		master_clock(miso);
+		slave_select(master_selected());
+		count++;
+	}
+	return count;
+}
+
+/*************************************************************************
+Function: loopback_expect()
+Purpose:  compare received bytes with the expected ones
+Input:    what is checked, bytes received and their number, expected
+          bytes and their number
+Returns:  none
+**************************************************************************/
+static void loopback_expect(const char *what, const uint8_t *got, uint16_t count,
+							const uint8_t *expected, uint16_t length){
+	
+	uint16_t i;
+	
+	if (count != length) {
+		printf("FAIL %s: %u bytes instead of %u\n", what, count, length);
+		loopback_errors++;
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		if (got[i] != expected[i]) {
+			printf("FAIL %s: byte %u is 0x%02X instead of 0x%02X\n", what, i, got[i], expected[i]);
+			loopback_errors++;
+			return;
+		}
+	}
+}
+
+/*************************************************************************
+Function: loopback_example()
+Purpose:  the exchange of the master and slave examples
+Input:    setting SPI_CLOCK_DIVx
+Returns:  none
+**************************************************************************/
+static void loopback_example(uint8_t setting){
+	
+	static const uint8_t zeros[10];
+	uint8_t received[64];
+	struct node_stats stats;
+	
+	master_start(setting);
+	slave_start();
+	
+	// SPI-example-Slave/main.c
+	slave_puts("WORLD HELLO");
+	// SPI-example-Master/main.c, then one of its reads
+	master_transmit("HELLO WORLD");
+	loopback_run();
+	loopback_expect("slave received", received, slave_receive(received, sizeof(received)),
+		(const uint8_t *)"HELLO WORLD", 11);
+	loopback_expect("master received", received, master_receive(received, sizeof(received)),
+		(const uint8_t *)"WORLD HELLO", 11);
+	
+	master_read(10);
+	loopback_run();
+	loopback_expect("slave received during the read", received, slave_receive(received, sizeof(received)), zeros, 10);
+	loopback_expect("master read", received, master_receive(received, sizeof(received)), zeros, 10);
+	
+	master_stats(&stats);
+	if (stats.transactions != 2 || stats.bytes != 21) {
+		printf("FAIL example: %u bytes in %u transactions instead of 21 in 2\n", stats.bytes, stats.transactions);
+		loopback_errors++;
+	}
+}
+
+/*************************************************************************
+Function: loopback_stress()
+Purpose:  random blocks both ways, the slave answering each master block
+Input:    setting SPI_CLOCK_DIVx, stats of both sides, host seconds spent
+Returns:  none
+**************************************************************************/
+static void loopback_stress(uint8_t setting, struct node_stats *master, struct node_stats *slave, double *seconds){
+	
+	uint8_t out[LOOPBACK_BLOCK + 1], answer[LOOPBACK_BLOCK + 1], expected[LOOPBACK_BLOCK + 1];
+	uint8_t received[LOOPBACK_BLOCK + 1];
+	uint16_t round, length, i;
+	clock_t start;
+	
+	master_start(setting);
+	slave_start();
+	srand(setting + 1);
+	start = clock();
+	
+	for (round = 0; round < LOOPBACK_ROUNDS && !loopback_errors; round++) {
+		length = 1 + rand() % LOOPBACK_BLOCK;
+		for (i = 0; i < length; i++) {
+			answer[i] = 1 + rand() % 255;
+		}
+		for (i = 0; i <= length; i++) {
+			out[i] = rand();
+		}
+		// The slave answers from the next byte on, its SPDR holds 0x00
+		// from the previous round when the master starts
+		if (!slave_write(answer, length) || !master_write(out, length + 1)) {
+			printf("FAIL stress: no room for %u bytes\n", length);
+			loopback_errors++;
+			break;
+		}
+		loopback_run();
+		loopback_expect("stress, slave received", received, slave_receive(received, sizeof(received)), out, length + 1);
+		expected[0] = 0x00;
+		memcpy(&expected[1], answer, length);
+		loopback_expect("stress, master received", received, master_receive(received, sizeof(received)), expected, length + 1);
+	}
+	*seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+	master_stats(master);
+	slave_stats(slave);
+	if (master->lost || slave->lost || master->isr_calls != master->bytes || slave->isr_calls != slave->bytes) {
+		printf("FAIL stress: lost %u/%u, %u/%u interrupts for %u bytes\n",
+			master->lost, slave->lost, master->isr_calls, slave->isr_calls, master->bytes);
+		loopback_errors++;
+	}
+}
+
+int main(void){
+	
+	struct node_stats master, slave;
+	uint8_t i;
+	double seconds;
+	unsigned long divider, cycles;
+	
+	printf("F_CPU %luHz, master interrupt estimated at %u AVR cycles per byte\n\n",
+		(unsigned long)F_CPU, LOOPBACK_AVR_ISR_CYCLES);
+	printf("divider    SCK(Hz)   wire(B/s)   AVR(B/s)  AVR cycles  host cycles/byte   host(B/s)\n");
+	printf("                                             per byte   master    slave\n");
+	
+	for (i = 0; i < sizeof(loopback_clocks); i++) {
+		loopback_example(loopback_clocks[i]);
+		loopback_stress(loopback_clocks[i], &master, &slave, &seconds);
+		if (loopback_errors) {
+			break;
+		}
+		divider = SPI_CLOCK_DIVIDER(loopback_clocks[i]);
+		cycles = 8 * divider + LOOPBACK_AVR_ISR_CYCLES;
+		printf("%7lu %10lu %11lu %10lu %11lu %8.0f %8.0f %11.0f\n",
+			divider, (unsigned long)(F_CPU / divider), (unsigned long)(F_CPU / (8 * divider)),
+			(unsigned long)(F_CPU / cycles), cycles,
+			(double)master.isr_cycles / master.bytes, (double)slave.isr_cycles / slave.bytes,
+			seconds > 0 ? master.bytes / seconds : 0.0);
+	}
+	
+	if (loopback_errors) {
+		printf("\n%d error(s)\n", loopback_errors);
+		return 1;
+	}
+	printf("\nHELLO WORLD / WORLD HELLO exchanged byte for byte at every divider\n");
+	return 0;
+}
@@ -0,0 +1,43 @@
+/*************************************************************************
+	
+	Loopback nodes, the only symbols exported by each role's object
+
+*************************************************************************/
+
+#ifndef NODE_H_
+#define NODE_H_
+
+#include <stdint.h>
+
+#define NODE_API	__attribute__((visibility("default")))
+
+struct node_stats
+{
+	uint32_t isr_calls;		// SPI interrupts run
+	uint64_t isr_cycles;	// host cycles spent in them
+	uint32_t bytes;			// bytes exchanged
+	uint32_t transactions;	// SS rises (master)
+	uint16_t lost;			// bytes dropped, receive buffer full
+};
+
+NODE_API void master_start(uint8_t clock);
+NODE_API void master_transmit(const char *s);
+NODE_API uint8_t master_write(const uint8_t *data, uint16_t count);
+NODE_API void master_read(uint16_t numberOfBytes);
+NODE_API uint8_t master_busy(void);
+NODE_API uint8_t master_selected(void);
+NODE_API uint8_t master_mosi(void);
+NODE_API void master_clock(uint8_t miso);
+NODE_API uint16_t master_receive(uint8_t *data, uint16_t max);
+NODE_API void master_stats(struct node_stats *stats);
+
+NODE_API void slave_start(void);
+NODE_API void slave_puts(const char *s);
+NODE_API uint8_t slave_write(const uint8_t *data, uint16_t count);
+NODE_API void slave_select(uint8_t selected);
+NODE_API uint8_t slave_miso(void);
+NODE_API void slave_clock(uint8_t mosi);
+NODE_API uint16_t slave_receive(uint8_t *data, uint16_t max);
+NODE_API void slave_stats(struct node_stats *stats);
+
+#endif /* NODE_H_ */
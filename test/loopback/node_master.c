@@ -0,0 +1,76 @@
+/*************************************************************************
+	
+	Master side of the loopback: SPI.c of the master example built in the
+	master role, in a shared object of its own so that its symbols and its
+	registers do not collide with the slave side.
+
+*************************************************************************/
+
+#include "SPI.c"
+#include "wire.h"
+#include "node.h"
+
+NODE_API void master_start(uint8_t clock){
+	
+	sim_reset();
+	wire_clear();
+	spi_master_init(SPI_MODE0, clock);
+}
+
+NODE_API void master_transmit(const char *s){
+	
+	spi_master_transmit(s);
+}
+
+NODE_API uint8_t master_write(const uint8_t *data, uint16_t count){
+	
+	if (!spi_write(data, count)) {
+		return 0;
+	}
+	spi_master_transmit("");	// starts the bytes just queued
+	return 1;
+}
+
+NODE_API void master_read(uint16_t numberOfBytes){
+	
+	spi_master_read(numberOfBytes);
+}
+
+NODE_API uint8_t master_busy(void){
+	
+	return wire_master_busy();
+}
+
+NODE_API uint8_t master_selected(void){
+	
+	return !(SPI_PORT & (1<<SPI_PIN_SS));
+}
+
+NODE_API uint8_t master_mosi(void){
+	
+	return SPDR;
+}
+
+NODE_API void master_clock(uint8_t miso){
+	
+	wire_master_clock(miso);
+}
+
+NODE_API uint16_t master_receive(uint8_t *data, uint16_t max){
+	
+	uint16_t count = 0;
+	
+	while (count < max && spi_available()) {
+		data[count++] = spi_getc();
+	}
+	return count;
+}
+
+NODE_API void master_stats(struct node_stats *stats){
+	
+	stats->isr_calls = sim_isr_calls;
+	stats->isr_cycles = sim_isr_cycles;
+	stats->bytes = wire_bytes;
+	stats->transactions = wire_transactions;
+	stats->lost = spi_rx_lost();
+}
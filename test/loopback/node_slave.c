@@ -0,0 +1,62 @@
+/*************************************************************************
+	
+	Slave side of the loopback: SPI.c of the slave example built in the
+	slave role, in a shared object of its own.
+
+*************************************************************************/
+
+#include "SPI.c"
+#include "wire.h"
+#include "node.h"
+
+NODE_API void slave_start(void){
+	
+	sim_reset();
+	wire_clear();
+	SPI_PIN |= (1<<SPI_PIN_SS);
+	spi_slave_init();
+}
+
+NODE_API void slave_puts(const char *s){
+	
+	spi_puts(s);
+}
+
+NODE_API uint8_t slave_write(const uint8_t *data, uint16_t count){
+	
+	return spi_write(data, count);
+}
+
+NODE_API void slave_select(uint8_t selected){
+	
+	wire_slave_select(selected);
+}
+
+NODE_API uint8_t slave_miso(void){
+	
+	return SPDR;
+}
+
+NODE_API void slave_clock(uint8_t mosi){
+	
+	wire_slave_clock(mosi);
+}
+
+NODE_API uint16_t slave_receive(uint8_t *data, uint16_t max){
+	
+	uint16_t count = 0;
+	
+	while (count < max && spi_available()) {
+		data[count++] = spi_getc();
+	}
+	return count;
+}
+
+NODE_API void slave_stats(struct node_stats *stats){
+	
+	stats->isr_calls = sim_isr_calls;
+	stats->isr_cycles = sim_isr_cycles;
+	stats->bytes = wire_bytes;
+	stats->transactions = wire_transactions;
+	stats->lost = spi_rx_lost();
+}
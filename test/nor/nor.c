@@ -0,0 +1,373 @@
+/*************************************************************************
+
+	NOR flash driver against a simulated chip on the polled path
+
+	The chip (JEDEC EF 40 12, 256KB, 256-byte pages) answers wake up,
+	read ID, read status, write enable, fast read, page program and the
+	sector, block and chip erases. Programs and erases take effect when
+	CS goes high, need the write enable latch and keep the chip busy for
+	a number of bytes clocked; a command other than read status while
+	busy is an error of the driver.
+
+	CS is on a pin of its own (NOR_CS X, 0) whose port register goes
+	through flash_cs(), so that the chip sees every CS edge and not only
+	the level at each byte.
+
+	Also checked: mode 0 MSB first on every byte with the chip selected,
+	the settings of the application back after every call, and a missing
+	chip (MISO floating high) giving NOR_ERROR_TIMEOUT instead of hanging.
+
+	The report gives the read and program throughput at NOR_CLOCK.
+
+*************************************************************************/
+
+#include <stdint.h>
+
+static volatile uint8_t *flash_cs(void);
+static volatile uint8_t flash_ddr, flash_pin;
+
+#define PORTX		(*flash_cs())
+#define DDRX		flash_ddr
+#define PINX		flash_pin
+#define NOR_CS		X, 0
+#define NOR_POLL_BUSY	20000UL		// missing chip detected quickly
+
+#include "SPI.c"
+#include "NOR.c"
+#include "wire.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define FLASH_SIZE			(256UL * 1024)
+#define FLASH_BUSY_PROGRAM	300		// bytes clocked while busy
+#define FLASH_BUSY_SECTOR	3000
+#define FLASH_BUSY_BLOCK	8000
+#define FLASH_BUSY_CHIP		15000
+
+static struct {
+	uint8_t present, awake;
+	uint8_t selected, command, enabled;
+	uint32_t count, address, busy;
+	uint8_t page[NOR_PAGE_SIZE];
+	uint16_t page_bytes;
+	uint8_t memory[FLASH_SIZE];
+	uint32_t bad_mode, while_busy, without_enable;
+} flash;
+
+static volatile uint8_t flash_port = 1;
+static uint8_t nor_test_spcr, nor_test_spi2x;
+static int nor_test_errors;
+
+/*************************************************************************
+Function: flash_rise()
+Purpose:  CS went high, programs and erases take effect
+Input:    none
+Returns:  none
+**************************************************************************/
+static void flash_rise(void){
+	
+	uint32_t start = 0, size = 0, i;
+	
+	flash.selected = 0;
+	if (!flash.count) {
+		return;
+	}
+	switch (flash.command) {
+		case NOR_CMD_WRITE_ENABLE:
+			flash.enabled = 1;
+			return;
+		case NOR_CMD_PAGE_PROGRAM:
+			if (flash.count < 4) {
+				return;
+			}
+			if (!flash.enabled) {
+				flash.without_enable++;
+				return;
+			}
+			// the bytes wrap inside the page, a program only clears bits
+			for (i = 0; i < flash.page_bytes && i < NOR_PAGE_SIZE; i++) {
+				flash.memory[(flash.address & ~(NOR_PAGE_SIZE - 1UL)) |
+							 ((flash.address + i) & (NOR_PAGE_SIZE - 1))] &= flash.page[i];
+			}
+			flash.busy = FLASH_BUSY_PROGRAM;
+			break;
+		case NOR_CMD_SECTOR_ERASE:
+			start = flash.address & ~(NOR_SECTOR_SIZE - 1);
+			size = NOR_SECTOR_SIZE;
+			flash.busy = FLASH_BUSY_SECTOR;
+			break;
+		case NOR_CMD_BLOCK_ERASE:
+			start = flash.address & ~(NOR_BLOCK_SIZE - 1);
+			size = NOR_BLOCK_SIZE;
+			flash.busy = FLASH_BUSY_BLOCK;
+			break;
+		case NOR_CMD_CHIP_ERASE:
+			size = FLASH_SIZE;
+			flash.busy = FLASH_BUSY_CHIP;
+			break;
+		default:
+			return;
+	}
+	if (size) {
+		if (!flash.enabled) {
+			flash.without_enable++;
+			flash.busy = 0;
+			return;
+		}
+		memset(&flash.memory[start % FLASH_SIZE], 0xFF, size);
+	}
+	flash.enabled = 0;
+}
+
+/*************************************************************************
+Function: flash_sync()
+Purpose:  follow the CS pin, called before each byte and pin access
+Input:    none
+Returns:  none
+**************************************************************************/
+static void flash_sync(void){
+	
+	uint8_t selected = !(flash_port & 1) && flash.present;
+	
+	if (flash.selected && !selected) {
+		flash_rise();
+	}
+	else if (!flash.selected && selected) {
+		flash.selected = 1;
+		flash.count = 0;
+		flash.page_bytes = 0;
+	}
+}
+
+/*************************************************************************
+Function: flash_cs()
+Purpose:  port register of the CS pin
+Input:    none
+Returns:  register, the write is seen at the next access or byte
+**************************************************************************/
+static volatile uint8_t *flash_cs(void){
+	
+	flash_sync();
+	return &flash_port;
+}
+
+/*************************************************************************
+Function: flash_exchange()
+Purpose:  sim_device of the chip
+Input:    MOSI
+Returns:  MISO
+**************************************************************************/
+static uint8_t flash_exchange(uint8_t mosi){
+	
+	uint8_t miso = 0xFF;
+	uint32_t index;
+	
+	flash_sync();
+	if (flash.busy) {
+		flash.busy--;
+	}
+	if (!flash.selected) {
+		return 0xFF;
+	}
+	if (SPCR & ((1<<CPOL)|(1<<CPHA)|(1<<DORD))) {
+		flash.bad_mode++;
+	}
+	
+	index = flash.count++;
+	if (index == 0) {
+		flash.command = mosi;
+		if (mosi == NOR_CMD_WAKE_UP) {
+			flash.awake = 1;
+		}
+		else if (mosi != NOR_CMD_READ_STATUS && (flash.busy || !flash.awake)) {
+			flash.while_busy++;
+			flash.command = 0;	// ignored
+		}
+		return miso;
+	}
+	
+	switch (flash.command) {
+		case NOR_CMD_READ_STATUS:
+			miso = (flash.busy ? NOR_STATUS_WIP : 0) | (flash.enabled ? 0x02 : 0);
+			break;
+		case NOR_CMD_READ_ID:
+			miso = index == 1 ? 0xEF : index == 2 ? 0x40 : index == 3 ? 0x12 : 0xFF;
+			break;
+		case NOR_CMD_FAST_READ:
+		case NOR_CMD_PAGE_PROGRAM:
+		case NOR_CMD_SECTOR_ERASE:
+		case NOR_CMD_BLOCK_ERASE:
+			if (index <= 3) {
+				flash.address = (flash.address << 8) | mosi;
+				if (index == 3) {
+					flash.address %= FLASH_SIZE;
+				}
+			}
+			else if (flash.command == NOR_CMD_FAST_READ) {
+				if (index > 4) {	// after the dummy byte
+					miso = flash.memory[(flash.address + index - 5) % FLASH_SIZE];
+				}
+			}
+			else if (flash.command == NOR_CMD_PAGE_PROGRAM) {
+				flash.page[flash.page_bytes++ % NOR_PAGE_SIZE] = mosi;
+			}
+			break;
+	}
+	return miso;
+}
+
+/*************************************************************************
+Function: nor_test_check()
+Purpose:  check a result, the settings of the application and the chip
+Input:    what is checked, status returned, status expected
+Returns:  none
+**************************************************************************/
+static void nor_test_check(const char *what, uint8_t status, uint8_t expected){
+	
+	flash_sync();
+	if (status != expected) {
+		printf("FAIL %s: status %u instead of %u\n", what, status, expected);
+		nor_test_errors++;
+	}
+	if (SPCR != nor_test_spcr || (sim_regs[SIM_SPSR] & (1<<SPI2X)) != nor_test_spi2x) {
+		printf("FAIL %s: SPCR %02X SPI2X %u left instead of %02X %u\n", what,
+			SPCR, sim_regs[SIM_SPSR] & (1<<SPI2X), nor_test_spcr, nor_test_spi2x);
+		nor_test_errors++;
+	}
+	if (flash.selected) {
+		printf("FAIL %s: chip still selected\n", what);
+		nor_test_errors++;
+	}
+	if (flash.bad_mode || flash.while_busy || flash.without_enable) {
+		printf("FAIL %s: %u bytes not in mode 0 MSB first, %u commands while busy, %u writes without enable\n",
+			what, flash.bad_mode, flash.while_busy, flash.without_enable);
+		nor_test_errors++;
+		flash.bad_mode = flash.while_busy = flash.without_enable = 0;
+	}
+}
+
+/*************************************************************************
+Function: nor_test_compare()
+Purpose:  compare the chip with the expected bytes
+Input:    what is checked, address, expected bytes, number of bytes
+Returns:  none
+**************************************************************************/
+static void nor_test_compare(const char *what, uint32_t address, const uint8_t *data, uint32_t length){
+	
+	uint32_t i;
+	
+	for (i = 0; i < length; i++) {
+		if (flash.memory[address + i] != data[i]) {
+			printf("FAIL %s: %02X at %05X instead of %02X\n", what,
+				flash.memory[address + i], address + i, data[i]);
+			nor_test_errors++;
+			return;
+		}
+	}
+}
+
+int main(void){
+	
+	static uint8_t data[NOR_SECTOR_SIZE], check[NOR_SECTOR_SIZE], erased[NOR_SECTOR_SIZE];
+	uint8_t id[3];
+	uint32_t i, bytes, polls;
+	double byte_rate = F_CPU / 2 / 8.0;	// bus bytes/s at NOR_CLOCK
+	
+	sim_reset();
+	sim_device = flash_exchange;
+	memset(erased, 0xFF, sizeof(erased));
+	for (i = 0; i < sizeof(data); i++) {
+		data[i] = rand();
+	}
+	
+	// settings of the application, none of them suits the chip
+	spi_master_init(SPI_MODE3, SPI_CLOCK_DIV64);
+	spi_master_settings(SPI_MODE3, SPI_CLOCK_DIV64, SPI_LSBFIRST);
+	nor_test_spcr = SPCR;
+	nor_test_spi2x = sim_regs[SIM_SPSR] & (1<<SPI2X);
+	
+	// missing chip: MISO stays high, seen as busy until NOR_POLL_BUSY
+	nor_init();
+	nor_test_check("id without chip", nor_read_id(id), NOR_ERROR_TIMEOUT);
+	nor_test_check("program without chip", nor_program(0, data, 16), NOR_ERROR_TIMEOUT);
+	nor_test_check("erase without chip", nor_erase_sector(0), NOR_ERROR_TIMEOUT);
+	
+	flash.present = 1;
+	memset(flash.memory, 0xFF, FLASH_SIZE);
+	nor_init();
+	nor_test_check("init", NOR_OK, NOR_OK);
+	nor_test_check("id", nor_read_id(id), NOR_OK);
+	if (id[0] != 0xEF || id[1] != 0x40 || id[2] != 0x12) {
+		printf("FAIL id %02X %02X %02X\n", id[0], id[1], id[2]);
+		nor_test_errors++;
+	}
+	
+	// program across two page boundaries, busy right after
+	nor_test_check("program", nor_program(0x1F0, data, 600), NOR_OK);
+	if (!nor_busy()) {
+		printf("FAIL not busy after a program\n");
+		nor_test_errors++;
+	}
+	nor_test_check("busy", NOR_OK, NOR_OK);
+	nor_test_check("wait", nor_wait_ready(), NOR_OK);
+	if (nor_busy()) {
+		printf("FAIL still busy after nor_wait_ready()\n");
+		nor_test_errors++;
+	}
+	nor_test_compare("program", 0x1F0, data, 600);
+	nor_test_compare("program, bytes around", 0x1F0 - 16, erased, 16);
+	nor_test_compare("program, bytes around", 0x1F0 + 600, erased, 16);
+	nor_test_check("read", nor_read(0x1F0, check, 600), NOR_OK);
+	if (memcmp(check, data, 600) != 0) {
+		printf("FAIL read back\n");
+		nor_test_errors++;
+	}
+	
+	// a read right after a program waits for it
+	nor_test_check("program again", nor_program(0x3000, data, NOR_PAGE_SIZE), NOR_OK);
+	nor_test_check("read while busy", nor_read(0x3000, check, NOR_PAGE_SIZE), NOR_OK);
+	if (memcmp(check, data, NOR_PAGE_SIZE) != 0) {
+		printf("FAIL read after program\n");
+		nor_test_errors++;
+	}
+	
+	// erases
+	nor_test_check("erase sector", nor_erase_sector(0x1234), NOR_OK);
+	nor_test_check("wait sector", nor_wait_ready(), NOR_OK);
+	nor_test_compare("erase sector", 0x1000, erased, NOR_SECTOR_SIZE);
+	nor_test_compare("sector before", 0x1F0, data, 600);
+	nor_test_check("erase block", nor_erase_block(0x100), NOR_OK);
+	nor_test_check("wait block", nor_wait_ready(), NOR_OK);
+	for (i = 0; i < NOR_BLOCK_SIZE; i += NOR_SECTOR_SIZE) {
+		nor_test_compare("erase block", i, erased, NOR_SECTOR_SIZE);
+	}
+	nor_test_check("program before chip erase", nor_program(0x30000, data, 64), NOR_OK);
+	nor_test_check("erase chip", nor_erase_chip(), NOR_OK);
+	nor_test_check("wait chip", nor_wait_ready(), NOR_OK);
+	nor_test_compare("erase chip", 0x30000, erased, 64);
+	
+	// throughput on the bus, busy time included for the program
+	bytes = sim_polled_bytes;
+	nor_program(0x10000, data, NOR_SECTOR_SIZE);
+	nor_wait_ready();
+	polls = sim_polled_bytes - bytes;
+	nor_test_compare("program sector", 0x10000, data, NOR_SECTOR_SIZE);
+	bytes = sim_polled_bytes;
+	nor_read(0x10000, check, NOR_SECTOR_SIZE);
+	bytes = sim_polled_bytes - bytes;
+	if (memcmp(check, data, NOR_SECTOR_SIZE) != 0) {
+		printf("FAIL read sector\n");
+		nor_test_errors++;
+	}
+	nor_test_check("throughput", NOR_OK, NOR_OK);
+	printf("read %u bytes in %u bus bytes (%.0f B/s at NOR_CLOCK), "
+		"program %u bytes in %u bus bytes with the busy polls (%.0f B/s with a %u-byte page program time)\n",
+		(unsigned)NOR_SECTOR_SIZE, bytes, byte_rate * NOR_SECTOR_SIZE / bytes,
+		(unsigned)NOR_SECTOR_SIZE, polls, byte_rate * NOR_SECTOR_SIZE / polls, FLASH_BUSY_PROGRAM);
+	
+	if (nor_test_errors) {
+		printf("%d error(s)\n", nor_test_errors);
+		return 1;
+	}
+	return 0;
+}
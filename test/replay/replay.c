@@ -0,0 +1,962 @@
+/*************************************************************************
+
+	Deterministic replay of recorded bus traces against the SPI master,
+	or against the slave when built with SPI_SLAVE_ENABLED
+
+	A trace file interleaves the API calls of the application with the
+	bytes recorded on the bus, one statement per line ('#' starts a
+	comment):
+
+	  timer <hz>                rate of the timestamps, for the report
+	  time <ticks>              SPI_LATENCY_TIMER from now on
+	  bus [@time] <sent> <received> [end]
+	                            one recorded byte (spi_trace_read() fields,
+	                            hex), the timer is set to its timestamp
+	                            before it completes. Master: the library must have it in
+	                            flight with this MOSI, gets this MISO, and
+	                            must put SS high after it exactly when
+	                            "end" is given. Slave: SS is put low, the
+	                            library must answer this MISO to this MOSI,
+	                            SS goes high after it with "end"
+	  clock <count> <hex>       clock count bytes, the other side counting
+	                            up from hex, the library side not checked
+	  stall / resume            the clock stops / restarts (dead slave)
+
+	  transmit <text>           spi_master_transmit(), spi_puts() on the
+	                            slave, text to end of line
+	  write <hex>...            spi_write()
+	  read <count>              spi_master_read()
+	  tick [count]              spi_master_tick()
+	  flush                     spi_master_flush()
+	  stream start|stop         spi_master_stream_start() / _stop()
+	  timeout <ticks>           spi_master_timeout()
+	  abort                     spi_master_abort()
+	  acquire / release         spi_master_acquire() / _release()
+	  exchange <hex>...         spi_master_exchange() of each byte, polled,
+	                            not in the bus log
+	  segments <hex>... [read <count>]
+	                            spi_master_transfer_segments() of a TX
+	                            segment and an optional RX one
+	  events immediate|deferred callback counting every event, run from
+	                            where it is raised / from spi_events_run()
+	  events run                spi_events_run()
+	  threshold <n>             spi_event_threshold()
+	  register <addr> <hex>... [ro]
+	                            adds a register of the slave map with this
+	                            content, read-only with "ro"
+	  regmap on|off             spi_slave_regmap() of the registers added
+	  slave <n>                 spi_profile_slave()
+	  latency reset             spi_latency_reset()
+	  bridge start|stop         spi_bridge_start() in UART mode / _stop()
+	  uart [count]              the USART takes the forwarded bytes, all
+	                            of them or count
+	  transfer <hex>... | transfer read <count>
+	                            spi_master_transfer() / spi_slave_transfer()
+	                            of these bytes or of 0x00, the received ones
+	                            kept (SPI_MINIMAL_ENABLED, instead of
+	                            transmit, write and read)
+
+	  expect rx <hex>...        next received bytes
+	  expect rx-seq <hex> <n>   next n received bytes count up from hex
+	  expect available <n>      spi_available()
+	  expect lost <n>           spi_rx_lost()
+	  expect timeouts <n>       spi_timeouts()
+	  expect idle|busy          SS high / low
+	  expect done|pending       ticket of the last call, or the buffers of
+	                            the last transfer
+	  expect transactions <n>   SS rises so far
+	  expect bytes <n>          bytes on the bus so far
+	  expect segment <hex>...   bytes of the last RX segment
+	  expect event rx|drained|complete|error|timeout <n>
+	                            callbacks of the event run so far
+	  expect register <addr> <hex>...
+	                            content of a register of the map
+	  expect written <addr> <n> write callbacks of a register so far
+	  expect received <hex>...  bytes received by the last transfer
+	  expect uart <hex>...      bytes the USART took since the last check
+	  expect latency txn|rx <max> <count>...
+	                            worst latency and counts of the buckets of
+	                            a spi_latency_dump() histogram, the buckets
+	                            not given must be empty
+	  expect profile <slave> <bytes> <transactions> <busy>
+	  expect gaps <count> <idle> <longest>
+	                            counters of spi_profile_dump()
+
+	A byte the library clocks but the trace does not hold, or the other
+	way round, fails the replay: extra bytes or transactions are
+	throughput regressions as much as lost ones. The report gives the
+	throughput of the recording and the host cycles per interrupt.
+
+	Built with SPI_TRACE_ENABLED, "replay <trace> <record>" writes the
+	trace back to record with the bytes read from spi_trace_read() after
+	each statement as bus lines, in place of its bus and clock lines:
+	the capture of a run, to be replayed by the other builds.
+
+*************************************************************************/
+
+#include "SPI.c"
+#include "wire.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define REPLAY_LINE		512
+
+static const char *replay_file;
+static unsigned replay_line;
+static int replay_errors;
+#if defined (SPI_MASTER_ENABLED) && !defined (SPI_MINIMAL_ENABLED)
+static spi_ticket replay_ticket;
+#endif
+static uint32_t replay_timer;			// timestamp rate, 0 if unknown
+static uint32_t replay_first, replay_last;	// timestamps of the recorded bytes
+static uint32_t replay_timed;			// recorded bytes with a timestamp
+#if defined (SPI_SG_ENABLED)
+static uint8_t replay_sg_tx[REPLAY_LINE], replay_sg_rx[REPLAY_LINE];
+static struct spi_segment replay_sg[2];
+#endif
+#if defined (SPI_MINIMAL_ENABLED)
+static uint8_t replay_transfer_tx[REPLAY_LINE], replay_transfer_rx[REPLAY_LINE];
+static uint16_t replay_transfer_length;
+#endif
+#if defined (SPI_TRACE_ENABLED)
+static FILE *replay_record;				// capture written back, 0 if none
+#endif
+#if defined (SPI_BRIDGE_ENABLED)
+static uint8_t replay_uart[REPLAY_LINE];	// bytes the USART took
+static uint16_t replay_uart_length;
+#endif
+#if defined (SPI_EVENTS_ENABLED)
+static const char *const replay_event_names[SPI_EVENT_COUNT] = {
+	"rx", "drained", "complete", "error", "timeout"
+};
+static unsigned replay_events[SPI_EVENT_COUNT];	// callbacks run per event
+#endif
+#if defined (SPI_REGMAP_ENABLED)
+#define REPLAY_REGISTERS	8
+static struct spi_register replay_registers[REPLAY_REGISTERS];
+static uint8_t replay_register_data[REPLAY_REGISTERS][16];
+static uint8_t replay_register_count;
+static unsigned replay_written[0x80];		// write callbacks per register address
+#endif
+
+/*************************************************************************
+Function: replay_fail()
+Purpose:  report a mismatch at the current line
+Input:    printf format and arguments
+Returns:  none
+**************************************************************************/
+static void replay_fail(const char *format, ...){
+
+	va_list args;
+
+	printf("%s:%u: ", replay_file, replay_line);
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+	replay_errors++;
+}
+
+/*************************************************************************
+Function: replay_number()
+Purpose:  parse the next number of a statement
+Input:    cursor in the line, base
+Returns:  number, fails the line if missing
+**************************************************************************/
+static unsigned long replay_number(char **cursor, int base){
+
+	char *end;
+	unsigned long value = strtoul(*cursor, &end, base);
+
+	if (end == *cursor) {
+		replay_fail("number expected");
+	}
+	*cursor = end;
+	return value;
+}
+
+/*************************************************************************
+Function: replay_more()
+Purpose:  tell if the statement has more words
+Input:    cursor in the line, skipped to the next word
+Returns:  1 if a word follows
+**************************************************************************/
+static uint8_t replay_more(char **cursor){
+
+	while (**cursor == ' ' || **cursor == '\t') {
+		(*cursor)++;
+	}
+	return **cursor != 0;
+}
+
+#if defined (SPI_MINIMAL_ENABLED)
+/*************************************************************************
+Function: replay_transfer_busy()
+Purpose:  tell if the caller buffers of the last transfer are in use
+Input:    none
+Returns:  1 if bytes are left
+**************************************************************************/
+static uint8_t replay_transfer_busy(void){
+
+#if defined (SPI_MASTER_ENABLED)
+	return spi_master_busy();
+#else
+	return spi_slave_busy();
+#endif
+}
+#endif
+
+#if defined (SPI_EVENTS_ENABLED)
+/*************************************************************************
+Function: replay_event()
+Purpose:  callback of every event, counts it
+Input:    event SPI_EVENT_x
+Returns:  none
+**************************************************************************/
+static void replay_event(uint8_t event){
+
+	uint8_t index;
+
+	for (index = 0; index < SPI_EVENT_COUNT; index++) {
+		if (event == (1<<index)) {
+			replay_events[index]++;
+			return;
+		}
+	}
+	replay_fail("callback run with %02X, not a single event", event);
+}
+#endif
+
+#if defined (SPI_REGMAP_ENABLED)
+/*************************************************************************
+Function: replay_register_written()
+Purpose:  write callback of every register, counts it
+Input:    address of the register
+Returns:  none
+**************************************************************************/
+static void replay_register_written(uint8_t address){
+
+	replay_written[address & 0x7F]++;
+}
+
+/*************************************************************************
+Function: replay_register()
+Purpose:  find a register added by the trace
+Input:    address of the register
+Returns:  register, 0 and the line fails if none
+**************************************************************************/
+static struct spi_register *replay_register(unsigned long address){
+
+	uint8_t index;
+
+	for (index = 0; index < replay_register_count; index++) {
+		if (replay_registers[index].address == address) {
+			return &replay_registers[index];
+		}
+	}
+	replay_fail("no register at %02lX", address);
+	return 0;
+}
+#endif
+
+/*************************************************************************
+Function: replay_bus()
+Purpose:  replay one recorded byte
+Input:    rest of the statement
+Returns:  none
+**************************************************************************/
+static void replay_bus(char *args){
+
+	uint8_t sent, received, end = 0;
+	uint32_t time = 0;
+	uint8_t timed = 0;
+
+	replay_more(&args);
+	if (*args == '@') {
+		args++;
+		time = replay_number(&args, 10);
+		timed = 1;
+		sim_tcnt1 = time;
+	}
+	sent = replay_number(&args, 16);
+	received = replay_number(&args, 16);
+	if (replay_more(&args)) {
+		end = (strncmp(args, "end", 3) == 0);
+		if (!end) {
+			replay_fail("unknown flag %s", args);
+		}
+	}
+
+#if defined (SPI_MASTER_ENABLED)
+	if (!wire_master_busy()) {
+		replay_fail("recorded byte %02X not started by the library", sent);
+		return;
+	}
+	if (SPDR != sent) {
+		replay_fail("MOSI %02X instead of %02X", SPDR, sent);
+	}
+	wire_master_clock(received);
+	if (wire_end[(wire_bytes - 1) % WIRE_LOG_SIZE] != end) {
+		replay_fail(end ? "SS still low after the last byte of the transaction"
+						: "SS put high in the middle of the transaction");
+	}
+#else
+	wire_slave_select(1);
+	if (SPDR != sent) {
+		replay_fail("MISO %02X instead of %02X", SPDR, sent);
+	}
+	wire_slave_clock(received);
+	if (end) {
+		wire_slave_select(0);
+	}
+#endif
+	if (timed) {
+		if (!replay_timed) {
+			replay_first = time;
+		}
+		replay_last = time;
+		replay_timed++;
+	}
+}
+
+/*************************************************************************
+Function: replay_expect()
+Purpose:  check the state of the library
+Input:    rest of the statement
+Returns:  none
+**************************************************************************/
+static void replay_expect(char *args){
+
+	unsigned long value, count;
+#if !defined (SPI_MINIMAL_ENABLED)
+	uint8_t data;
+#endif
+#if defined (SPI_REGMAP_ENABLED)
+	struct spi_register *reg;
+#endif
+#if defined (SPI_PROFILE_ENABLED)
+	struct spi_profile_stats profile;
+	struct spi_profile_slave *slave;
+#endif
+#if defined (SPI_LATENCY_ENABLED)
+	struct spi_latency_stats latency;
+	uint16_t *histogram, max;
+#endif
+
+	replay_more(&args);
+	if (strncmp(args, "transactions", 12) == 0) {
+		args += 12;
+		value = replay_number(&args, 10);
+		if (wire_transactions != value) {
+			replay_fail("%u transactions instead of %lu", wire_transactions, value);
+		}
+	}
+	else if (strncmp(args, "bytes", 5) == 0) {
+		args += 5;
+		value = replay_number(&args, 10);
+		if (wire_bytes != value) {
+			replay_fail("%u bytes on the bus instead of %lu", wire_bytes, value);
+		}
+	}
+#if defined (SPI_MINIMAL_ENABLED)
+	else if (strncmp(args, "received", 8) == 0) {
+		args += 8;
+		count = 0;
+		while (replay_more(&args)) {
+			value = replay_number(&args, 16);
+			if (count >= replay_transfer_length || replay_transfer_rx[count] != value) {
+				replay_fail("transfer byte %lu is not %02lX", count, value);
+				return;
+			}
+			count++;
+		}
+	}
+	else if (strncmp(args, "done", 4) == 0) {
+		if (replay_transfer_busy()) {
+			replay_fail("transfer not done");
+		}
+	}
+	else if (strncmp(args, "pending", 7) == 0) {
+		if (!replay_transfer_busy()) {
+			replay_fail("transfer already done");
+		}
+	}
+#else
+	else if (strncmp(args, "rx-seq", 6) == 0) {
+		args += 6;
+		value = replay_number(&args, 16);
+		count = replay_number(&args, 10);
+		while (count--) {
+			if (!spi_available()) {
+				replay_fail("receive buffer empty, %lu bytes missing", count + 1);
+				return;
+			}
+			data = spi_getc();
+			if (data != (uint8_t)value) {
+				replay_fail("received %02X instead of %02X", data, (uint8_t)value);
+				return;
+			}
+			value++;
+		}
+	}
+	else if (strncmp(args, "rx", 2) == 0) {
+		args += 2;
+		while (replay_more(&args)) {
+			value = replay_number(&args, 16);
+			if (!spi_available()) {
+				replay_fail("receive buffer empty, %02lX expected", value);
+				return;
+			}
+			data = spi_getc();
+			if (data != value) {
+				replay_fail("received %02X instead of %02lX", data, value);
+				return;
+			}
+		}
+	}
+	else if (strncmp(args, "available", 9) == 0) {
+		args += 9;
+		value = replay_number(&args, 10);
+		if (spi_available() != value) {
+			replay_fail("%u bytes available instead of %lu", spi_available(), value);
+		}
+	}
+	else if (strncmp(args, "lost", 4) == 0) {
+		args += 4;
+		value = replay_number(&args, 10);
+		if (spi_rx_lost() != value) {
+			replay_fail("%u bytes lost instead of %lu", spi_rx_lost(), value);
+		}
+	}
+#endif
+#if defined (SPI_TIMEOUT_ENABLED)
+	else if (strncmp(args, "timeouts", 8) == 0) {
+		args += 8;
+		value = replay_number(&args, 10);
+		if (spi_timeouts() != value) {
+			replay_fail("%u timeouts instead of %lu", spi_timeouts(), value);
+		}
+	}
+#endif
+#if defined (SPI_SG_ENABLED)
+	else if (strncmp(args, "segment", 7) == 0) {
+		args += 7;
+		count = 0;
+		while (replay_more(&args)) {
+			value = replay_number(&args, 16);
+			if (count >= replay_sg[1].length || replay_sg_rx[count] != value) {
+				replay_fail("segment byte %lu is not %02lX", count, value);
+				return;
+			}
+			count++;
+		}
+	}
+#endif
+#if defined (SPI_EVENTS_ENABLED)
+	else if (strncmp(args, "event", 5) == 0) {
+		args += 5;
+		replay_more(&args);
+		for (count = 0; count < SPI_EVENT_COUNT; count++) {
+			if (strncmp(args, replay_event_names[count], strlen(replay_event_names[count])) == 0) {
+				break;
+			}
+		}
+		if (count == SPI_EVENT_COUNT) {
+			replay_fail("unknown event %s", args);
+			return;
+		}
+		args += strlen(replay_event_names[count]);
+		value = replay_number(&args, 10);
+		if (replay_events[count] != value) {
+			replay_fail("%u %s callbacks instead of %lu", replay_events[count], replay_event_names[count], value);
+		}
+	}
+#endif
+#if defined (SPI_REGMAP_ENABLED)
+	else if (strncmp(args, "register", 8) == 0) {
+		args += 8;
+		reg = replay_register(replay_number(&args, 16));
+		count = 0;
+		while (reg && replay_more(&args)) {
+			value = replay_number(&args, 16);
+			if (count >= reg->size || reg->data[count] != value) {
+				replay_fail("register %02X byte %lu is not %02lX", reg->address, count, value);
+				return;
+			}
+			count++;
+		}
+	}
+	else if (strncmp(args, "written", 7) == 0) {
+		args += 7;
+		value = replay_number(&args, 16) & 0x7F;
+		count = replay_number(&args, 10);
+		if (replay_written[value] != count) {
+			replay_fail("%u write callbacks of %02lX instead of %lu", replay_written[value], value, count);
+		}
+	}
+#endif
+#if defined (SPI_BRIDGE_ENABLED)
+	else if (strncmp(args, "uart", 4) == 0) {
+		args += 4;
+		count = 0;
+		while (replay_more(&args)) {
+			value = replay_number(&args, 16);
+			if (count >= replay_uart_length || replay_uart[count] != value) {
+				replay_fail("USART byte %lu is not %02lX", count, value);
+				break;
+			}
+			count++;
+		}
+		if (count < replay_uart_length && !replay_errors) {
+			replay_fail("%u more bytes went to the USART", replay_uart_length - count);
+		}
+		replay_uart_length = 0;
+	}
+#endif
+#if defined (SPI_LATENCY_ENABLED)
+	else if (strncmp(args, "latency", 7) == 0) {
+		args += 7;
+		replay_more(&args);
+		spi_latency_dump(&latency);
+		if (strncmp(args, "txn", 3) == 0) {
+			args += 3;
+			histogram = latency.transaction;
+			max = latency.transaction_max;
+		} else {
+			args += 2;
+			histogram = latency.rx_queue;
+			max = latency.rx_queue_max;
+		}
+		value = replay_number(&args, 10);
+		if (max != value) {
+			replay_fail("worst latency %u instead of %lu", max, value);
+		}
+		for (count = 0; count < SPI_LATENCY_BUCKETS; count++) {
+			value = replay_more(&args) ? replay_number(&args, 10) : 0;
+			if (histogram[count] != value) {
+				replay_fail("bucket %lu holds %u instead of %lu", count, histogram[count], value);
+			}
+		}
+	}
+#endif
+#if defined (SPI_PROFILE_ENABLED)
+	else if (strncmp(args, "profile", 7) == 0) {
+		args += 7;
+		spi_profile_dump(&profile);
+		value = replay_number(&args, 10);
+		if (value >= SPI_PROFILE_SLAVES) {
+			replay_fail("no slave %lu in the profiler", value);
+			return;
+		}
+		slave = &profile.slave[value];
+		if (slave->bytes != replay_number(&args, 10) ||
+			slave->transactions != replay_number(&args, 10) ||
+			slave->busy != replay_number(&args, 10)) {
+			replay_fail("slave %lu: %u bytes, %u transactions, %u ticks busy", value,
+				slave->bytes, slave->transactions, slave->busy);
+		}
+	}
+	else if (strncmp(args, "gaps", 4) == 0) {
+		args += 4;
+		spi_profile_dump(&profile);
+		if (profile.gaps != replay_number(&args, 10) ||
+			profile.idle != replay_number(&args, 10) ||
+			profile.idle_max != replay_number(&args, 10)) {
+			replay_fail("%u gaps, %u ticks idle, longest %u", profile.gaps, profile.idle, profile.idle_max);
+		}
+	}
+#endif
+#if defined (SPI_MASTER_ENABLED)
+	else if (strncmp(args, "idle", 4) == 0) {
+		if (!(SPI_PORT & (1<<SPI_PIN_SS))) {
+			replay_fail("SS low, idle expected");
+		}
+	}
+	else if (strncmp(args, "busy", 4) == 0) {
+		if (SPI_PORT & (1<<SPI_PIN_SS)) {
+			replay_fail("SS high, busy expected");
+		}
+	}
+#if !defined (SPI_MINIMAL_ENABLED)
+	else if (strncmp(args, "done", 4) == 0) {
+		if (!spi_async_done(replay_ticket)) {
+			replay_fail("ticket %u not done", replay_ticket);
+		}
+	}
+	else if (strncmp(args, "pending", 7) == 0) {
+		if (spi_async_done(replay_ticket)) {
+			replay_fail("ticket %u already done", replay_ticket);
+		}
+	}
+#endif
+#endif
+	else {
+		replay_fail("unknown expectation %s", args);
+	}
+}
+
+#if defined (SPI_TRACE_ENABLED)
+/*************************************************************************
+Function: replay_capture()
+Purpose:  write a statement to the capture, followed by the bytes the
+          library recorded meanwhile
+Input:    line of the trace, before replay_statement() cuts it
+Returns:  none
+**************************************************************************/
+static void replay_capture(const char *line){
+
+	while (*line == ' ' || *line == '\t') {
+		line++;
+	}
+	if (strncmp(line, "bus", 3) != 0 && strncmp(line, "clock", 5) != 0) {
+		fprintf(replay_record, "%s\n", line);
+	}
+}
+
+/*************************************************************************
+Function: replay_capture_bytes()
+Purpose:  write the bytes recorded by the library as bus lines
+Input:    none
+Returns:  none
+**************************************************************************/
+static void replay_capture_bytes(void){
+
+	struct spi_trace_entry entry;
+
+	while (spi_trace_read(&entry)) {
+		fprintf(replay_record, "bus @%u %02X %02X%s\n", entry.time, entry.sent, entry.received,
+			(entry.flags & SPI_TRACE_END) ? " end" : "");
+	}
+}
+#endif
+
+/*************************************************************************
+Function: replay_statement()
+Purpose:  run one line of the trace
+Input:    line without its end of line
+Returns:  none
+**************************************************************************/
+static void replay_statement(char *line){
+
+	char *args;
+	unsigned long count, value;
+	uint16_t length = 0;
+#if !defined (SPI_MINIMAL_ENABLED)
+	uint8_t data[REPLAY_LINE];
+#endif
+#if defined (SPI_REGMAP_ENABLED)
+	struct spi_register *reg;
+#endif
+#if defined (SPI_MINIMAL_ENABLED)
+	const uint8_t *tx;
+#endif
+
+	while (*line == ' ' || *line == '\t') {
+		line++;
+	}
+	if (*line == 0 || *line == '#') {
+		return;
+	}
+	args = line;
+	while (*args && *args != ' ' && *args != '\t') {
+		args++;
+	}
+	if (*args) {
+		*args++ = 0;
+	}
+
+	if (strcmp(line, "bus") == 0) {
+		replay_bus(args);
+	}
+	else if (strcmp(line, "clock") == 0) {
+		count = replay_number(&args, 10);
+		value = replay_number(&args, 16);
+		while (count--) {
+#if defined (SPI_MASTER_ENABLED)
+			if (!wire_master_busy()) {
+				replay_fail("only part of the bytes clocked, %lu left", count + 1);
+				break;
+			}
+			wire_master_clock(value++);
+#else
+			wire_slave_select(1);
+			wire_slave_clock(value++);
+#endif
+		}
+	}
+	else if (strcmp(line, "stall") == 0) {
+		wire_stalled = 1;
+	}
+	else if (strcmp(line, "resume") == 0) {
+		wire_stalled = 0;
+	}
+	else if (strcmp(line, "timer") == 0) {
+		replay_timer = replay_number(&args, 10);
+	}
+	else if (strcmp(line, "time") == 0) {
+		sim_tcnt1 = replay_number(&args, 10);
+	}
+#if defined (SPI_MASTER_ENABLED)
+	else if (strcmp(line, "acquire") == 0) {
+		spi_master_acquire();
+	}
+	else if (strcmp(line, "exchange") == 0) {
+		while (replay_more(&args)) {
+			spi_master_exchange(replay_number(&args, 16));
+		}
+	}
+	else if (strcmp(line, "release") == 0) {
+		spi_master_release();
+	}
+#endif
+#if defined (SPI_BRIDGE_ENABLED)
+	else if (strcmp(line, "bridge") == 0) {
+		if (strncmp(args, "start", 5) == 0) {
+			spi_bridge_start(0, SPI_BRIDGE_UART);
+		} else {
+			spi_bridge_stop();
+		}
+	}
+	else if (strcmp(line, "uart") == 0) {
+		count = replay_more(&args) ? replay_number(&args, 10) : REPLAY_LINE;
+		while (count-- && (UCSR0B & (1<<UDRIE0)) && replay_uart_length < REPLAY_LINE) {
+			sim_isr(SPI_BRIDGE_UDRE_vect);
+			replay_uart[replay_uart_length++] = UDR0;
+		}
+	}
+#endif
+#if defined (SPI_LATENCY_ENABLED)
+	else if (strcmp(line, "latency") == 0) {
+		spi_latency_reset();
+	}
+#endif
+#if defined (SPI_PROFILE_ENABLED)
+	else if (strcmp(line, "slave") == 0) {
+		spi_profile_slave(replay_number(&args, 10));
+	}
+#endif
+#if defined (SPI_MINIMAL_ENABLED)
+	else if (strcmp(line, "transfer") == 0) {
+		tx = replay_transfer_tx;
+		while (replay_more(&args) && strncmp(args, "read", 4) != 0) {
+			replay_transfer_tx[length++] = replay_number(&args, 16);
+		}
+		if (replay_more(&args)) {
+			args += 4;
+			length = replay_number(&args, 10);
+			tx = 0;		// 0x00 sent
+		}
+		replay_transfer_length = length;
+		memset(replay_transfer_rx, 0, sizeof(replay_transfer_rx));
+	#if defined (SPI_MASTER_ENABLED)
+		if (!spi_master_transfer(tx, replay_transfer_rx, length)) {
+			replay_fail("transfer not started, bus busy");
+		}
+	#else
+		spi_slave_transfer(tx, replay_transfer_rx, length);
+	#endif
+	}
+#else
+	else if (strcmp(line, "write") == 0) {
+		while (replay_more(&args)) {
+			data[length++] = replay_number(&args, 16);
+		}
+		if (!spi_write(data, length)) {
+			replay_fail("no room for %u bytes", length);
+		}
+	}
+#endif
+#if defined (SPI_EVENTS_ENABLED)
+	else if (strcmp(line, "events") == 0) {
+		if (strncmp(args, "run", 3) == 0) {
+			spi_events_run();
+		} else {
+			for (count = 0; count < SPI_EVENT_COUNT; count++) {
+				spi_event_register(1<<count, replay_event, strncmp(args, "deferred", 8) == 0);
+			}
+		}
+	}
+	else if (strcmp(line, "threshold") == 0) {
+		spi_event_threshold(replay_number(&args, 10));
+	}
+#endif
+#if defined (SPI_REGMAP_ENABLED)
+	else if (strcmp(line, "register") == 0) {
+		reg = &replay_registers[replay_register_count];
+		reg->address = replay_number(&args, 16);
+		reg->data = replay_register_data[replay_register_count];
+		reg->on_write = replay_register_written;
+		while (replay_more(&args) && strncmp(args, "ro", 2) != 0 &&
+			reg->size < sizeof(replay_register_data[0])) {
+			reg->data[reg->size++] = replay_number(&args, 16);
+		}
+		if (replay_more(&args)) {
+			reg->flags = SPI_REG_READONLY;
+		}
+		if (replay_register_count < REPLAY_REGISTERS - 1) {
+			replay_register_count++;
+		}
+	}
+	else if (strcmp(line, "regmap") == 0) {
+		spi_slave_regmap(replay_registers, strncmp(args, "on", 2) == 0 ? replay_register_count : 0);
+	}
+#endif
+#if defined (SPI_MINIMAL_ENABLED)
+#elif defined (SPI_SLAVE_ENABLED)
+	else if (strcmp(line, "transmit") == 0) {
+		spi_puts(args);
+	}
+#else
+	else if (strcmp(line, "transmit") == 0) {
+		replay_ticket = spi_master_transmit(args);
+	}
+	else if (strcmp(line, "read") == 0) {
+		replay_ticket = spi_master_read(replay_number(&args, 10));
+	}
+#endif
+	else if (strcmp(line, "tick") == 0) {
+		count = replay_more(&args) ? replay_number(&args, 10) : 1;
+		while (count--) {
+#if defined (SPI_BATCH_ENABLED) || defined (SPI_TIMEOUT_ENABLED)
+			spi_master_tick();
+#endif
+		}
+	}
+#if defined (SPI_BATCH_ENABLED)
+	else if (strcmp(line, "flush") == 0) {
+		replay_ticket = spi_master_flush();
+	}
+#endif
+#if defined (SPI_READAHEAD_ENABLED)
+	else if (strcmp(line, "stream") == 0) {
+		if (strncmp(args, "start", 5) == 0) {
+			replay_ticket = spi_master_stream_start();
+		} else {
+			spi_master_stream_stop();
+		}
+	}
+#endif
+#if defined (SPI_TIMEOUT_ENABLED)
+	else if (strcmp(line, "timeout") == 0) {
+		spi_master_timeout(replay_number(&args, 10));
+	}
+	else if (strcmp(line, "abort") == 0) {
+		spi_master_abort();
+	}
+#endif
+#if defined (SPI_SG_ENABLED)
+	else if (strcmp(line, "segments") == 0) {
+		while (replay_more(&args) && strncmp(args, "read", 4) != 0) {
+			replay_sg_tx[length++] = replay_number(&args, 16);
+		}
+		replay_sg[0].data = replay_sg_tx;
+		replay_sg[0].length = length;
+		replay_sg[0].flags = SPI_SEG_TX;
+		replay_sg[1].data = replay_sg_rx;
+		replay_sg[1].length = 0;
+		replay_sg[1].flags = SPI_SEG_RX;
+		if (replay_more(&args)) {
+			args += 4;
+			replay_sg[1].length = replay_number(&args, 10);
+		}
+		memset(replay_sg_rx, 0, sizeof(replay_sg_rx));
+		if (!spi_master_transfer_segments(replay_sg, 2)) {
+			replay_fail("segment list not started, bus busy");
+		}
+	}
+#endif
+	else if (strcmp(line, "expect") == 0) {
+		replay_expect(args);
+	}
+	else {
+		replay_fail("unknown statement %s (or option not built)", line);
+	}
+}
+
+int main(int argc, char *argv[]){
+
+	FILE *file;
+	char line[REPLAY_LINE];
+	size_t length;
+
+	if (argc != 2 && argc != 3) {
+		printf("usage: %s <trace> [record]\n", argv[0]);
+		return 2;
+	}
+	if (argc == 3) {
+#if defined (SPI_TRACE_ENABLED)
+		replay_record = fopen(argv[2], "w");
+		if (!replay_record) {
+			perror(argv[2]);
+			return 2;
+		}
+#else
+		printf("%s: built without SPI_TRACE_ENABLED, nothing to record\n", argv[0]);
+		return 2;
+#endif
+	}
+	replay_file = argv[1];
+	file = fopen(replay_file, "r");
+	if (!file) {
+		perror(replay_file);
+		return 2;
+	}
+
+	sim_reset();
+	wire_clear();
+#if defined (SPI_MASTER_ENABLED)
+	spi_master_init(SPI_MODE0, SPI_CLOCK_DIV4);
+#else
+	SPI_PIN |= (1<<SPI_PIN_SS);
+	spi_slave_init();
+#endif
+
+	while (fgets(line, sizeof(line), file)) {
+		replay_line++;
+		length = strlen(line);
+		while (length && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+			line[--length] = 0;
+		}
+#if defined (SPI_TRACE_ENABLED)
+		if (replay_record) {
+			replay_capture(line);
+			replay_statement(line);
+			replay_capture_bytes();
+			continue;
+		}
+#endif
+		replay_statement(line);
+	}
+	fclose(file);
+#if defined (SPI_TRACE_ENABLED)
+	if (replay_record) {
+		fclose(replay_record);
+	}
+#endif
+
+#if defined (SPI_MASTER_ENABLED)
+	if (wire_master_busy()) {
+		replay_fail("the library still clocks bytes the trace does not hold");
+	}
+#else
+	if (!(SPI_PIN & (1<<SPI_PIN_SS))) {
+		replay_fail("SS still low, the last byte has no end");
+	}
+#endif
+
+	printf("%s: %u bytes in %u transactions replayed", replay_file, wire_bytes, wire_transactions);
+	if (replay_timer && replay_timed > 1 && replay_last != replay_first) {
+		printf(", recorded %.0f B/s", (double)(replay_timed - 1) * replay_timer / (replay_last - replay_first));
+	}
+	if (sim_isr_calls) {
+		printf(", host %.0f cycles per interrupt", (double)sim_isr_cycles / sim_isr_calls);
+	}
+	printf("\n");
+
+	if (replay_errors) {
+		printf("%d error(s)\n", replay_errors);
+		return 1;
+	}
+	return 0;
+}
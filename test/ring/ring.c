@@ -0,0 +1,248 @@
+/*************************************************************************
+
+	Fuzz of the reserve/commit transmit ringbuffer with two producers
+
+	The main code queues chunks with spi_write() while a timer signal,
+	standing for the interrupts of the MCU, runs at any instruction
+	outside ATOMIC_BLOCK: it clocks bytes out of the SPI like the SPI
+	interrupt and queues its own chunks with spi_write() and spi_putc()
+	like a UART or timer interrupt would. The same interrupt also runs at
+	random exits of the ATOMIC_BLOCK of the library (sim_irq_exit), which
+	is where the reservations of the main code are taken, so that it lands
+	between a reservation and its commit far more often than the signal
+	alone would.
+
+	Each byte carries its producer in bit 7 and the low bits of its chunk
+	number, the chunk lengths follow from the seed. The bytes on MOSI must
+	be every chunk of each producer, in order, each chunk contiguous,
+	nothing lost or repeated.
+
+	The report gives the bytes/s through the ring and how often the
+	interrupt queued a chunk while the main code held a reservation.
+
+	usage: ring [seed [chunks]]
+
+*************************************************************************/
+
+#include "SPI.c"
+#include "wire.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define RING_PERIOD_US		20		// timer signal period
+#define RING_CLOCK_MAX		32		// bytes clocked per signal at most
+#define RING_MAIN_MAX		48		// longest chunk of the main code
+#define RING_ISR_MAX		8		// longest chunk of the interrupt
+
+static uint32_t ring_seed;
+static uint32_t ring_state;					// generator of the firing points
+static volatile uint32_t ring_isr_chunks;	// chunks queued by the interrupt
+static volatile uint32_t ring_isr_nested;	// of which inside a reservation of main
+static volatile uint32_t ring_isr_full;		// chunks put off, ring full
+static volatile uint32_t ring_isr_enabled;	// the interrupt produces chunks
+static uint32_t ring_next[2];				// next chunk expected of each producer
+static uint8_t ring_source;					// producer of the chunk being checked
+static uint16_t ring_left;					// bytes of it still expected
+static uint32_t ring_bytes;					// bytes checked
+static volatile int ring_errors;
+
+/*************************************************************************
+Function: ring_length()
+Purpose:  length of a chunk, the same for the producer and the checker
+Input:    producer (0 main, 1 interrupt), chunk number
+Returns:  bytes
+**************************************************************************/
+static uint16_t ring_length(uint8_t source, uint32_t chunk){
+	
+	uint32_t hash = (chunk * 2 + source) ^ ring_seed;
+	
+	hash ^= hash >> 16;
+	hash *= 0x45D9F3B;
+	hash ^= hash >> 16;
+	return 1 + hash % (source ? RING_ISR_MAX : RING_MAIN_MAX);
+}
+
+/*************************************************************************
+Function: ring_byte()
+Purpose:  content of the bytes of a chunk
+Input:    producer, chunk number
+Returns:  byte
+**************************************************************************/
+static inline uint8_t ring_byte(uint8_t source, uint32_t chunk){
+	
+	return (source << 7) | (chunk & 0x7F);
+}
+
+/*************************************************************************
+Function: ring_check()
+Purpose:  check one byte sent on MOSI
+Input:    byte
+Returns:  none
+**************************************************************************/
+static void ring_check(uint8_t mosi){
+	
+	uint8_t source = mosi >> 7;
+	
+	if (ring_left) {
+		// in the middle of a chunk: nothing else may come in between
+		if (mosi != ring_byte(ring_source, ring_next[ring_source] - 1)) {
+			if (ring_errors++ < 10) {
+				printf("byte %u: %02X inside chunk %u of producer %u, %u bytes before its end\n",
+					ring_bytes, mosi, ring_next[ring_source] - 1, ring_source, ring_left);
+			}
+		}
+		ring_left--;
+	}
+	else {
+		if (mosi != ring_byte(source, ring_next[source])) {
+			if (ring_errors++ < 10) {
+				printf("byte %u: %02X instead of chunk %u of producer %u\n",
+					ring_bytes, mosi, ring_next[source], source);
+			}
+		}
+		ring_source = source;
+		ring_left = ring_length(source, ring_next[source]) - 1;
+		ring_next[source]++;
+	}
+	ring_bytes++;
+}
+
+/*************************************************************************
+Function: ring_clock()
+Purpose:  clock the bytes queued, SPI interrupt side
+Input:    maximum number of bytes
+Returns:  none
+**************************************************************************/
+static void ring_clock(uint16_t count){
+	
+	// a transaction is started by the next call of the main code, or here
+	if (SPI_CTS == SPI_INACTIVE && SPI_TxHead != SPI_TxTail) {
+		spi_master_transmit("");
+	}
+	while (count-- && wire_master_busy()) {
+		ring_check(wire_master_clock(0xFF));
+	}
+	spi_flush();	// nobody reads the bytes received
+}
+
+/*************************************************************************
+Function: ring_interrupt()
+Purpose:  timer signal, SPI interrupt and interrupt queuing its own chunks
+Input:    none
+Returns:  none
+**************************************************************************/
+static void ring_interrupt(void){
+	
+	uint8_t data[RING_ISR_MAX];
+	uint16_t length, i, used;
+	uint32_t chunk = ring_isr_chunks;
+	
+	ring_clock(RING_CLOCK_MAX);
+	if (!ring_isr_enabled) {
+		return;
+	}
+	
+	length = ring_length(1, chunk);
+	used = (SPI_TxReserve - SPI_TxTail) & SPI_TX_BUFFER_MASK;
+	if (length > SPI_TX_BUFFER_MASK - used) {
+		ring_isr_full++;
+		return;
+	}
+	if (SPI_TxPending) {
+		ring_isr_nested++;
+	}
+	if (length == 1) {
+		spi_putc(ring_byte(1, chunk));
+	}
+	else {
+		for (i = 0; i < length; i++) {
+			data[i] = ring_byte(1, chunk);
+		}
+		spi_write(data, length);
+	}
+	ring_isr_chunks = chunk + 1;
+}
+
+/*************************************************************************
+Function: ring_exit()
+Purpose:  firing point at the end of an ATOMIC_BLOCK of the main code
+Input:    none
+Returns:  none
+**************************************************************************/
+static void ring_exit(void){
+	
+	ring_state ^= ring_state << 13;
+	ring_state ^= ring_state >> 17;
+	ring_state ^= ring_state << 5;
+	if (ring_state % 4 == 0) {
+		ring_interrupt();
+	}
+}
+
+int main(int argc, char *argv[]){
+	
+	uint8_t data[RING_MAIN_MAX];
+	uint32_t chunks = 60000, chunk;
+	uint16_t length, i;
+	struct timespec begin, end;
+	double seconds;
+	
+	ring_seed = argc > 1 ? strtoul(argv[1], 0, 0) : 1;
+	if (argc > 2) {
+		chunks = strtoul(argv[2], 0, 0);
+	}
+	
+	sim_reset();
+	wire_clear();
+	spi_master_init(SPI_MODE0, SPI_CLOCK_DIV4);
+	ring_isr_enabled = 1;
+	ring_state = ring_seed | 1;
+	sim_irq_exit = ring_exit;
+	
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	sim_async_start(ring_interrupt, RING_PERIOD_US);
+	
+	for (chunk = 0; chunk < chunks; chunk++) {
+		length = ring_length(0, chunk);
+		for (i = 0; i < length; i++) {
+			data[i] = ring_byte(0, chunk);
+		}
+		while (!spi_write(data, length)) {
+			// full, the interrupt makes room
+		}
+		spi_master_transmit("");
+	}
+	
+	// let everything out with the interrupt still running
+	ring_isr_enabled = 0;
+	while (SPI_TxHead != SPI_TxTail || SPI_CTS == SPI_ACTIVE) {
+	}
+	sim_async_stop();
+	sim_irq_exit = 0;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ring_clock(SPI_TX_BUFFER_SIZE);
+	seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+	
+	if (ring_next[0] != chunks || ring_next[1] != ring_isr_chunks || ring_left) {
+		printf("chunks sent: main %u of %u, interrupt %u of %u, %u bytes missing of the last\n",
+			ring_next[0], chunks, ring_next[1], ring_isr_chunks, ring_left);
+		ring_errors++;
+	}
+	if (ring_bytes != wire_bytes) {
+		printf("%u bytes checked of %u on the bus\n", ring_bytes, wire_bytes);
+		ring_errors++;
+	}
+	
+	printf("seed %u: %u bytes in %u + %u chunks, %.0f bytes/s through the ring, "
+		"%u chunks of the interrupt inside a reservation, %u put off (full), "
+		"%u signals held by ATOMIC_BLOCK\n",
+		ring_seed, ring_bytes, chunks, ring_isr_chunks, ring_bytes / seconds,
+		ring_isr_nested, ring_isr_full, sim_async_deferred);
+	
+	if (ring_errors) {
+		printf("%d error(s)\n", ring_errors);
+		return 1;
+	}
+	return 0;
+}
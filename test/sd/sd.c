@@ -0,0 +1,431 @@
+/*************************************************************************
+
+	SD card driver against a simulated card on the polled path
+
+	The card answers the SPI mode protocol of SD.c: CMD0, CMD8, ACMD41,
+	CMD58 and CMD16 for the initialization, CMD17/CMD18 with CMD12 for the
+	reads, CMD24/CMD25 with their data tokens and busy time for the
+	writes. It runs as an SDHC card (block addresses) and as a standard
+	capacity SD v2 card (byte addresses, CMD16 expected).
+
+	Checked on every byte clocked with the card selected: SPI mode 0,
+	MSB first, and below 400KHz until the card leaves the idle state.
+	Checked after every call: SPCR and SPI2X are back to the settings of
+	the application (mode 3, LSB first, interrupt enabled) and SS is high.
+
+	The report gives the bus bytes per sector and the sectors/s that makes
+	at SD_CLOCK_FAST, multiple block commands against single ones.
+
+*************************************************************************/
+
+#include "SPI.c"
+#include "SD.c"
+#include "wire.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CARD_BLOCKS			64		// capacity of the simulated card
+#define CARD_QUEUE			1024	// MISO bytes waiting
+#define CARD_ACCESS			3		// 0xFF bytes before a data token
+#define CARD_BUSY			20		// bytes of busy after a block written
+#define CARD_INIT_POLLS		3		// ACMD41 answered idle this many times
+
+#define CARD_CMD			0		// waiting for a command frame
+#define CARD_READ			1		// sending blocks
+#define CARD_WRITE_TOKEN	2		// waiting for a data token
+#define CARD_WRITE_DATA		3		// receiving a block and its CRC
+
+static struct {
+	uint8_t present, high_capacity;
+	uint8_t state, idle, app, multiple, init_left;
+	uint32_t block;
+	uint8_t frame[6], frame_length;
+	uint8_t queue[CARD_QUEUE];
+	uint16_t queue_head, queue_tail;
+	uint8_t data[SD_BLOCK_SIZE + 2];
+	uint16_t data_length;
+	uint8_t blocks[CARD_BLOCKS][SD_BLOCK_SIZE];
+	uint32_t commands, bad_mode, too_fast;
+} card;
+
+static uint8_t sd_test_spcr, sd_test_spi2x;
+static int sd_test_errors;
+
+/*************************************************************************
+Function: card_push()
+Purpose:  queue bytes the card answers on MISO
+Input:    byte, number of times
+Returns:  none
+**************************************************************************/
+static void card_push(uint8_t data, uint16_t count){
+	
+	while (count--) {
+		card.queue[card.queue_head] = data;
+		card.queue_head = (card.queue_head + 1) % CARD_QUEUE;
+	}
+}
+
+/*************************************************************************
+Function: card_push_block()
+Purpose:  queue the access time, start token, data and CRC of a block
+Input:    none, reads card.block and moves to the next one
+Returns:  none
+**************************************************************************/
+static void card_push_block(void){
+	
+	uint16_t i;
+	
+	card_push(0xFF, CARD_ACCESS);
+	if (card.block >= CARD_BLOCKS) {
+		card_push(0x08, 1);			// data error token, out of range
+		card.state = CARD_CMD;
+		return;
+	}
+	card_push(SD_TOKEN_START, 1);
+	for (i = 0; i < SD_BLOCK_SIZE; i++) {
+		card_push(card.blocks[card.block][i], 1);
+	}
+	card_push(0x5A, 2);				// CRC, not checked by the driver
+	card.block++;
+}
+
+/*************************************************************************
+Function: card_address()
+Purpose:  block addressed by a read or write command
+Input:    argument
+Returns:  block number, CARD_BLOCKS if invalid
+**************************************************************************/
+static uint32_t card_address(uint32_t argument){
+	
+	if (card.high_capacity) {
+		return argument < CARD_BLOCKS ? argument : CARD_BLOCKS;
+	}
+	if (argument % SD_BLOCK_SIZE || argument / SD_BLOCK_SIZE >= CARD_BLOCKS) {
+		return CARD_BLOCKS;
+	}
+	return argument / SD_BLOCK_SIZE;
+}
+
+/*************************************************************************
+Function: card_command()
+Purpose:  run a command frame, queue its response after one NCR byte
+Input:    none, reads card.frame
+Returns:  none
+**************************************************************************/
+static void card_command(void){
+	
+	uint8_t command = card.frame[0] & 0x3F;
+	uint32_t argument = ((uint32_t)card.frame[1] << 24) | ((uint32_t)card.frame[2] << 16) |
+						((uint32_t)card.frame[3] << 8) | card.frame[4];
+	uint8_t app = card.app;
+	uint32_t block;
+	
+	card.commands++;
+	card.app = 0;
+	card.queue_tail = card.queue_head;	// a command ends what was being sent
+	card.state = CARD_CMD;
+	
+	if (command == SD_CMD12) {
+		card_push(0xFF, 2);				// stuff byte and NCR
+		card_push(0x00, 1);
+		card_push(0x00, 4);				// busy
+		return;
+	}
+	card_push(0xFF, 1);
+	
+	if (command == SD_CMD0) {
+		card.idle = 1;
+		card.init_left = CARD_INIT_POLLS;
+		card_push(0x01, 1);
+	}
+	else if (command == SD_CMD8) {
+		card_push(card.idle, 1);
+		card_push(0x00, 2);
+		card_push(0x01, 1);
+		card_push(card.frame[4], 1);	// check pattern echoed
+	}
+	else if (command == SD_CMD55) {
+		card.app = 1;
+		card_push(card.idle, 1);
+	}
+	else if (command == 41 && app) {
+		if (card.high_capacity && !(argument & (1UL<<30))) {
+			card_push(card.idle, 1);	// SDHC stays idle without HCS
+		}
+		else {
+			if (card.init_left && --card.init_left == 0) {
+				card.idle = 0;
+			}
+			card_push(card.idle, 1);
+		}
+	}
+	else if (command == SD_CMD58) {
+		card_push(card.idle, 1);
+		card_push(0x80 | (card.high_capacity ? 0x40 : 0), 1);
+		card_push(0xFF, 1);
+		card_push(0x80, 1);
+		card_push(0x00, 1);
+	}
+	else if (command == SD_CMD16) {
+		card_push(argument == SD_BLOCK_SIZE ? 0x00 : 0x40, 1);
+	}
+	else if (card.idle) {
+		card_push(0x05, 1);				// illegal command while idle
+	}
+	else if (command == SD_CMD17 || command == SD_CMD18 || command == SD_CMD24 || command == SD_CMD25) {
+		block = card_address(argument);
+		if (block >= CARD_BLOCKS) {
+			card_push(0x20, 1);			// address error
+			return;
+		}
+		card_push(0x00, 1);
+		card.block = block;
+		card.multiple = (command == SD_CMD18 || command == SD_CMD25);
+		if (command == SD_CMD17 || command == SD_CMD18) {
+			card.state = CARD_READ;
+			card_push_block();
+		}
+		else {
+			card.state = CARD_WRITE_TOKEN;
+		}
+	}
+	else {
+		card_push(0x04, 1);				// illegal command
+	}
+}
+
+/*************************************************************************
+Function: card_exchange()
+Purpose:  sim_device of the card
+Input:    MOSI
+Returns:  MISO
+**************************************************************************/
+static uint8_t card_exchange(uint8_t mosi){
+	
+	uint8_t miso = 0xFF;
+	uint8_t spr = SPCR & ((1<<SPR1)|(1<<SPR0));
+	uint32_t divider = (spr == 0 ? 4 : spr == 1 ? 16 : spr == 2 ? 64 : 128) >>
+					   ((sim_regs[SIM_SPSR] & (1<<SPI2X)) ? 1 : 0);
+	
+	if (!card.present || (PORTB & (1<<4))) {
+		card.frame_length = 0;
+		return 0xFF;
+	}
+	if (SPCR & ((1<<CPOL)|(1<<CPHA)|(1<<DORD))) {
+		card.bad_mode++;
+	}
+	if (card.idle && F_CPU / divider > 400000UL) {
+		card.too_fast++;
+	}
+	
+	if (card.queue_tail != card.queue_head) {
+		miso = card.queue[card.queue_tail];
+		card.queue_tail = (card.queue_tail + 1) % CARD_QUEUE;
+		if (card.queue_tail == card.queue_head && card.state == CARD_READ && card.multiple) {
+			card_push_block();
+		}
+	}
+	
+	switch (card.state) {
+		case CARD_WRITE_TOKEN:
+			if (card.queue_tail != card.queue_head) {
+				break;					// still answering or busy
+			}
+			if (mosi == (card.multiple ? SD_TOKEN_MULTI : SD_TOKEN_START)) {
+				card.state = CARD_WRITE_DATA;
+				card.data_length = 0;
+			}
+			else if (mosi == SD_TOKEN_STOP && card.multiple) {
+				card_push(0xFF, 1);
+				card_push(0x00, CARD_BUSY);
+				card.state = CARD_CMD;
+			}
+			break;
+		case CARD_WRITE_DATA:
+			card.data[card.data_length++] = mosi;
+			if (card.data_length == sizeof(card.data)) {
+				if (card.block < CARD_BLOCKS) {
+					memcpy(card.blocks[card.block++], card.data, SD_BLOCK_SIZE);
+					card_push(0xE0 | SD_DATA_ACCEPTED, 1);
+				}
+				else {
+					card_push(0xED, 1);	// write error
+				}
+				card_push(0x00, CARD_BUSY);
+				card.state = card.multiple ? CARD_WRITE_TOKEN : CARD_CMD;
+			}
+			break;
+		default:
+			if (card.frame_length || (mosi & 0xC0) == 0x40) {
+				card.frame[card.frame_length++] = mosi;
+				if (card.frame_length == sizeof(card.frame)) {
+					card.frame_length = 0;
+					card_command();
+				}
+			}
+			break;
+	}
+	
+	return miso;
+}
+
+/*************************************************************************
+Function: card_insert()
+Purpose:  power up a card, erased to a known pattern
+Input:    present, high capacity
+Returns:  none
+**************************************************************************/
+static void card_insert(uint8_t present, uint8_t high_capacity){
+	
+	uint16_t block, i;
+	
+	memset(&card, 0, sizeof(card));
+	card.present = present;
+	card.high_capacity = high_capacity;
+	card.idle = 1;
+	for (block = 0; block < CARD_BLOCKS; block++) {
+		for (i = 0; i < SD_BLOCK_SIZE; i++) {
+			card.blocks[block][i] = block ^ i;
+		}
+	}
+}
+
+/*************************************************************************
+Function: sd_test_check()
+Purpose:  check a result and that the settings of the application are back
+Input:    what is checked, status returned, status expected
+Returns:  none
+**************************************************************************/
+static void sd_test_check(const char *what, uint8_t status, uint8_t expected){
+	
+	if (status != expected) {
+		printf("FAIL %s: status %u instead of %u\n", what, status, expected);
+		sd_test_errors++;
+	}
+	if (SPCR != sd_test_spcr || (sim_regs[SIM_SPSR] & (1<<SPI2X)) != sd_test_spi2x) {
+		printf("FAIL %s: SPCR %02X SPI2X %u left instead of %02X %u\n", what,
+			SPCR, sim_regs[SIM_SPSR] & (1<<SPI2X), sd_test_spcr, sd_test_spi2x);
+		sd_test_errors++;
+	}
+	if (!(PORTB & (1<<4))) {
+		printf("FAIL %s: card still selected\n", what);
+		sd_test_errors++;
+	}
+	if (card.bad_mode || card.too_fast) {
+		printf("FAIL %s: %u bytes not in mode 0 MSB first, %u above 400KHz while idle\n",
+			what, card.bad_mode, card.too_fast);
+		sd_test_errors++;
+		card.bad_mode = card.too_fast = 0;
+	}
+}
+
+/*************************************************************************
+Function: sd_test_compare()
+Purpose:  compare a buffer with blocks of the card
+Input:    what is checked, buffer, first block, number of blocks
+Returns:  none
+**************************************************************************/
+static void sd_test_compare(const char *what, const uint8_t *data, uint32_t block, uint16_t count){
+	
+	if (memcmp(data, card.blocks[block], (uint32_t)count * SD_BLOCK_SIZE) != 0) {
+		printf("FAIL %s: data differs from blocks %u to %u of the card\n",
+			what, block, block + count - 1);
+		sd_test_errors++;
+	}
+}
+
+/*************************************************************************
+Function: sd_test_card()
+Purpose:  run the driver against one card
+Input:    high capacity
+Returns:  none
+**************************************************************************/
+static void sd_test_card(uint8_t high_capacity){
+	
+	static uint8_t data[16 * SD_BLOCK_SIZE], check[16 * SD_BLOCK_SIZE];
+	uint32_t i, bytes, single, multiple;
+	uint64_t cycles;
+	double sector_rate = F_CPU / 2 / 8.0;	// bytes/s at SD_CLOCK_FAST
+	
+	card_insert(1, high_capacity);
+	sd_test_check("init", sd_init(), SD_OK);
+	if (sd_type() != (high_capacity ? SD_TYPE_SDHC : SD_TYPE_SD2)) {
+		printf("FAIL type %u\n", sd_type());
+		sd_test_errors++;
+	}
+	
+	for (i = 0; i < sizeof(data); i++) {
+		data[i] = rand();
+	}
+	
+	// single block
+	sd_test_check("read block", sd_read_block(3, check), SD_OK);
+	sd_test_compare("read block", check, 3, 1);
+	sd_test_check("write block", sd_write_block(5, data), SD_OK);
+	sd_test_compare("write block", data, 5, 1);
+	
+	// multiple blocks, written then read back both ways
+	sd_test_check("write blocks", sd_write_blocks(20, data, 16), SD_OK);
+	sd_test_compare("write blocks", data, 20, 16);
+	sd_test_check("read blocks", sd_read_blocks(19, check, 16), SD_OK);
+	sd_test_compare("read blocks", check, 19, 16);
+	sd_test_check("read block after blocks", sd_read_block(35, check), SD_OK);
+	sd_test_compare("read block after blocks", check, 35, 1);
+	
+	// out of the card
+	sd_test_check("read out of range", sd_read_block(CARD_BLOCKS, check), SD_ERROR_COMMAND);
+	sd_test_check("write out of range", sd_write_block(CARD_BLOCKS + 1, data), SD_ERROR_COMMAND);
+	sd_test_check("read after error", sd_read_block(0, check), SD_OK);
+	sd_test_compare("read after error", check, 0, 1);
+	
+	// bus bytes and host time per sector
+	bytes = sim_polled_bytes;
+	sd_read_block(1, check);
+	single = sim_polled_bytes - bytes;
+	bytes = sim_polled_bytes;
+	cycles = sim_cycles();
+	sd_read_blocks(40, check, 16);
+	cycles = sim_cycles() - cycles;
+	multiple = (sim_polled_bytes - bytes) / 16;
+	printf("%s: read %u bus bytes per sector alone, %u in 16 (%.0f / %.0f sectors/s at SD_CLOCK_FAST), "
+		"host %.0f cycles per sector\n", high_capacity ? "SDHC" : "SD v2",
+		single, multiple, sector_rate / single, sector_rate / multiple, (double)cycles / 16);
+	
+	bytes = sim_polled_bytes;
+	sd_write_block(1, data);
+	single = sim_polled_bytes - bytes;
+	bytes = sim_polled_bytes;
+	sd_write_blocks(40, data, 16);
+	multiple = (sim_polled_bytes - bytes) / 16;
+	printf("%s: write %u bus bytes per sector alone, %u in 16 (%.0f / %.0f sectors/s at SD_CLOCK_FAST)\n",
+		high_capacity ? "SDHC" : "SD v2", single, multiple, sector_rate / single, sector_rate / multiple);
+	sd_test_check("throughput", SD_OK, SD_OK);
+}
+
+int main(void){
+	
+	static uint8_t check[SD_BLOCK_SIZE];
+	
+	sim_reset();
+	sim_device = card_exchange;
+	
+	// settings of the application, none of them suits the card
+	spi_master_init(SPI_MODE3, SPI_CLOCK_DIV64);
+	spi_master_settings(SPI_MODE3, SPI_CLOCK_DIV64, SPI_LSBFIRST);
+	sd_test_spcr = SPCR;
+	sd_test_spi2x = sim_regs[SIM_SPSR] & (1<<SPI2X);
+	
+	// no card: the driver gives up and stays usable
+	card_insert(0, 1);
+	sd_test_check("init without card", sd_init(), SD_ERROR_INIT);
+	sd_test_check("read without card", sd_read_block(0, check), SD_ERROR_INIT);
+	
+	sd_test_card(1);
+	sd_test_card(0);
+	
+	if (sd_test_errors) {
+		printf("%d error(s)\n", sd_test_errors);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,218 @@
+/*************************************************************************
+
+	spi_master_settings() and spi_master_set_clock() on the registers
+
+	Every SPI_CLOCK_DIVx, SPI_MODEx and bit order is applied and read back
+	from SPCR and SPSR against the ATmega table: SPR1:SPR0 select 4, 16,
+	64 or 128, SPI2X halves it (DIV2, DIV8 and DIV32), CPOL:CPHA give the
+	mode and DORD the bit order. SPIE, SPE and MSTR must be kept.
+
+	Then the settings are changed while a transaction runs: the byte
+	interrupts fire at each exit of the wait loop of spi_master_settings(),
+	one of them queues one more byte. The call must return only once SS
+	went high, every byte of that transaction clocked with the settings it
+	started with, and the next transaction must run with the new ones.
+
+*************************************************************************/
+
+#include "SPI.c"
+#include "wire.h"
+#include <stdio.h>
+#include <string.h>
+
+#define SETTINGS_SPCR_KEPT	((1<<SPIE)|(1<<SPE)|(1<<MSTR))
+
+static const struct {
+	uint8_t clock;
+	uint8_t spr;			// SPR1:SPR0
+	uint8_t spi2x;
+	unsigned long divider;
+} settings_clocks[] = {
+	{ SPI_CLOCK_DIV2,   0, 1,   2 },
+	{ SPI_CLOCK_DIV4,   0, 0,   4 },
+	{ SPI_CLOCK_DIV8,   1, 1,   8 },
+	{ SPI_CLOCK_DIV16,  1, 0,  16 },
+	{ SPI_CLOCK_DIV32,  2, 1,  32 },
+	{ SPI_CLOCK_DIV64,  2, 0,  64 },
+	{ SPI_CLOCK_DIV128, 3, 0, 128 },
+};
+
+static const uint8_t settings_modes[4] = {
+	SPI_MODE0, SPI_MODE1, SPI_MODE2, SPI_MODE3
+};
+
+static uint8_t settings_spcr[WIRE_LOG_SIZE];	// SPCR when each byte was clocked
+static uint8_t settings_spsr[WIRE_LOG_SIZE];	// SPSR when each byte was clocked
+static uint32_t settings_fired;					// interrupt points while waiting
+static uint32_t settings_write_at;				// byte after which one more is queued
+static int settings_errors;
+
+/*************************************************************************
+Function: settings_expected()
+Purpose:  SPCR of a mode, clock and bit order from the datasheet bits
+Input:    index of the mode (0 -> 3), entry of settings_clocks, 1 if LSB first
+Returns:  SPCR
+**************************************************************************/
+static uint8_t settings_expected(uint8_t mode, uint8_t clock, uint8_t lsb){
+
+	return SETTINGS_SPCR_KEPT |
+		((mode & 0x02) ? (1<<CPOL) : 0) | ((mode & 0x01) ? (1<<CPHA) : 0) |
+		(lsb ? (1<<DORD) : 0) | (settings_clocks[clock].spr << SPR0);
+}
+
+/*************************************************************************
+Function: settings_check()
+Purpose:  compare SPCR and SPI2X with the expected settings
+Input:    what is checked, expected SPCR, expected SPI2X
+Returns:  none
+**************************************************************************/
+static void settings_check(const char *what, uint8_t spcr, uint8_t spi2x){
+
+	uint8_t spsr = sim_regs[SIM_SPSR];	// not through SPSR, it would clock a byte
+
+	if (SPCR != spcr || ((spsr >> SPI2X) & 1) != spi2x) {
+		printf("FAIL %s: SPCR %02X SPI2X %u instead of %02X %u\n", what,
+			SPCR, (spsr >> SPI2X) & 1, spcr, spi2x);
+		settings_errors++;
+	}
+}
+
+/*************************************************************************
+Function: settings_clock()
+Purpose:  clock the byte in flight, noting the settings it went out with
+Input:    none
+Returns:  none
+**************************************************************************/
+static void settings_clock(void){
+
+	static const uint8_t more = 0x55;
+
+	if (wire_bytes < WIRE_LOG_SIZE) {
+		settings_spcr[wire_bytes] = SPCR;
+		settings_spsr[wire_bytes] = sim_regs[SIM_SPSR] & (1<<SPI2X);
+	}
+	wire_master_clock(0xA5);
+	if (wire_bytes == settings_write_at) {
+		spi_write(&more, 1);
+	}
+}
+
+/*************************************************************************
+Function: settings_irq()
+Purpose:  interrupt point of the main code, the byte in flight completes
+Input:    none
+Returns:  none
+**************************************************************************/
+static void settings_irq(void){
+
+	settings_fired++;
+	if (wire_master_busy()) {
+		settings_clock();
+	}
+}
+
+/*************************************************************************
+Function: settings_bytes()
+Purpose:  check the settings a range of logged bytes went out with
+Input:    what is checked, first byte, number of bytes, SPCR, SPI2X
+Returns:  none
+**************************************************************************/
+static void settings_bytes(const char *what, uint32_t first, uint32_t count, uint8_t spcr, uint8_t spi2x){
+
+	uint32_t i;
+
+	for (i = first; i < first + count; i++) {
+		if (settings_spcr[i] != spcr || (settings_spsr[i] != 0) != spi2x) {
+			printf("FAIL %s: byte %u clocked with SPCR %02X SPI2X %u instead of %02X %u\n", what,
+				i, settings_spcr[i], settings_spsr[i] != 0, spcr, spi2x);
+			settings_errors++;
+			return;
+		}
+	}
+}
+
+int main(void){
+
+	uint8_t mode, clock, lsb;
+	uint8_t spcr, old_spcr, new_spcr;
+	char what[64];
+
+	sim_reset();
+	wire_clear();
+	spi_master_init(SPI_MODE0, SPI_CLOCK_DIV4);
+	settings_check("spi_master_init", settings_expected(0, 1, 0), 0);
+
+	// every combination, idle bus: applied at once, nothing clocked
+	for (clock = 0; clock < sizeof(settings_clocks) / sizeof(settings_clocks[0]); clock++) {
+		if (SPI_CLOCK_DIVIDER(settings_clocks[clock].clock) != settings_clocks[clock].divider) {
+			printf("FAIL SPI_CLOCK_DIVIDER of DIV%lu gives %lu\n", settings_clocks[clock].divider,
+				SPI_CLOCK_DIVIDER(settings_clocks[clock].clock));
+			settings_errors++;
+		}
+		for (mode = 0; mode < 4; mode++) {
+			for (lsb = 0; lsb < 2; lsb++) {
+				spi_master_settings(settings_modes[mode], settings_clocks[clock].clock,
+					lsb ? SPI_LSBFIRST : SPI_MSBFIRST);
+				snprintf(what, sizeof(what), "mode %u DIV%lu %s", mode,
+					settings_clocks[clock].divider, lsb ? "LSB first" : "MSB first");
+				spcr = settings_expected(mode, clock, lsb);
+				settings_check(what, spcr, settings_clocks[clock].spi2x);
+			}
+		}
+	}
+
+	// the clock alone, mode and bit order kept
+	spi_master_settings(SPI_MODE2, SPI_CLOCK_DIV4, SPI_LSBFIRST);
+	for (clock = 0; clock < sizeof(settings_clocks) / sizeof(settings_clocks[0]); clock++) {
+		spi_master_set_clock(settings_clocks[clock].clock);
+		snprintf(what, sizeof(what), "spi_master_set_clock DIV%lu", settings_clocks[clock].divider);
+		settings_check(what, settings_expected(2, clock, 1), settings_clocks[clock].spi2x);
+	}
+	if (wire_bytes || SPI_CTS != SPI_INACTIVE) {
+		printf("FAIL settings on an idle bus clocked %u bytes\n", wire_bytes);
+		settings_errors++;
+	}
+
+	// changed while "ABCD" goes out, one more byte queued by an interrupt
+	spi_master_settings(SPI_MODE0, SPI_CLOCK_DIV4, SPI_MSBFIRST);
+	old_spcr = settings_expected(0, 1, 0);
+	new_spcr = settings_expected(3, 4, 1);
+	spi_master_transmit("ABCD");
+	settings_write_at = 2;
+	sim_irq_exit = settings_irq;
+	spi_master_settings(SPI_MODE3, SPI_CLOCK_DIV32, SPI_LSBFIRST);
+	sim_irq_exit = 0;
+	settings_check("after the transaction", new_spcr, 1);
+	if (wire_bytes != 5 || wire_transactions != 1 || !wire_end[4] || SPI_CTS != SPI_INACTIVE) {
+		printf("FAIL returned after %u bytes and %u transactions, SS %s\n", wire_bytes,
+			wire_transactions, SPI_CTS == SPI_INACTIVE ? "high" : "low");
+		settings_errors++;
+	}
+	if (wire_bytes == 5 && (memcmp(wire_mosi, "ABCD\x55", 5) != 0 || wire_end[3])) {
+		printf("FAIL transaction sent %02X %02X %02X %02X %02X\n",
+			wire_mosi[0], wire_mosi[1], wire_mosi[2], wire_mosi[3], wire_mosi[4]);
+		settings_errors++;
+	}
+	settings_bytes("running transaction", 0, 5, old_spcr, 0);
+
+	// the next one with the new settings, the bytes queued before it too
+	settings_write_at = 0;
+	spi_master_read(2);
+	spi_master_transmit("EF");
+	while (wire_master_busy()) {
+		settings_clock();
+	}
+	if (wire_bytes != 9 || wire_transactions != 2) {
+		printf("FAIL next transaction: %u bytes, %u transactions\n", wire_bytes, wire_transactions);
+		settings_errors++;
+	}
+	settings_bytes("next transaction", 5, 4, new_spcr, 1);
+
+	printf("%u mode, clock and bit order combinations, %u interrupt points while a transaction ran\n",
+		(unsigned)(sizeof(settings_clocks) / sizeof(settings_clocks[0])) * 8, settings_fired);
+	if (settings_errors) {
+		printf("%d error(s)\n", settings_errors);
+		return 1;
+	}
+	return 0;
+}
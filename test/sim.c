@@ -0,0 +1,202 @@
+/*************************************************************************
+	
+	Host simulation of the MCU around the SPI library
+
+*************************************************************************/
+
+#include "sim.h"
+#include <avr/io.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#if defined (__x86_64__) || defined (__i386__)
+#include <x86intrin.h>
+#endif
+
+volatile uint8_t sim_regs[256];
+volatile uint16_t sim_tcnt1;
+
+sim_device_fn sim_device;
+void (*sim_irq_exit)(void);
+uint32_t sim_polled_bytes;
+uint32_t sim_isr_calls;
+uint64_t sim_isr_cycles;
+uint32_t sim_async_deferred;
+
+static volatile sig_atomic_t sim_irq_depth;		// nested ATOMIC_BLOCK and vectors
+static volatile sig_atomic_t sim_irq_pending;	// signal held by the mask
+static void (*sim_async_handler)(void);
+
+/*************************************************************************
+Function: sim_reset()
+Purpose:  clear the registers and counters
+Input:    none
+Returns:  none
+**************************************************************************/
+void sim_reset(void){
+	
+	memset((void *)sim_regs, 0, sizeof(sim_regs));
+	sim_tcnt1 = 0;
+	sim_polled_bytes = 0;
+	sim_isr_calls = 0;
+	sim_isr_cycles = 0;
+	sim_async_deferred = 0;
+}
+
+/*************************************************************************
+Function: sim_spsr()
+Purpose:  access to SPSR, completes a polled master transfer
+Input:    none
+Returns:  SPSR location
+**************************************************************************/
+volatile uint8_t *sim_spsr(void){
+	
+	uint8_t spcr = sim_regs[0x4C];
+	
+	if ((spcr & ((1<<SPE)|(1<<MSTR)|(1<<SPIE))) == ((1<<SPE)|(1<<MSTR))) {
+		uint8_t mosi = SPDR;
+		SPDR = sim_device ? sim_device(mosi) : 0xFF;
+		sim_regs[SIM_SPSR] |= (1<<SPIF);
+		sim_polled_bytes++;
+	}
+	return &sim_regs[SIM_SPSR];
+}
+
+/*************************************************************************
+Function: sim_irq_mask()
+Purpose:  entry of ATOMIC_BLOCK, masks the simulated interrupts
+Input:    none
+Returns:  1
+**************************************************************************/
+uint8_t sim_irq_mask(void){
+	
+	sim_irq_depth++;
+	__asm__ volatile ("" ::: "memory");
+	return 1;
+}
+
+/*************************************************************************
+Function: sim_irq_unmask()
+Purpose:  exit of ATOMIC_BLOCK, runs the interrupt held meanwhile
+Input:    unused, cleanup attribute argument
+Returns:  none
+**************************************************************************/
+void sim_irq_unmask(const uint8_t *unused){
+	
+	(void)unused;
+	__asm__ volatile ("" ::: "memory");
+	if (--sim_irq_depth == 0) {
+		while (sim_irq_pending) {
+			sim_irq_pending = 0;
+			sim_irq_depth++;
+			sim_async_handler();
+			sim_irq_depth--;
+		}
+		if (sim_irq_exit) {
+			sim_irq_depth++;
+			sim_irq_exit();
+			sim_irq_depth--;
+		}
+	}
+}
+
+/*************************************************************************
+Function: sim_cycles()
+Purpose:  host cycle counter
+Input:    none
+Returns:  cycles
+**************************************************************************/
+uint64_t sim_cycles(void){
+	
+#if defined (__x86_64__) || defined (__i386__)
+	return __rdtsc();
+#else
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+/*************************************************************************
+Function: sim_isr()
+Purpose:  run an interrupt vector with the interrupts masked
+Input:    vector
+Returns:  none
+**************************************************************************/
+void sim_isr(void (*vector)(void)){
+	
+	uint64_t start;
+	
+	sim_irq_depth++;
+	start = sim_cycles();
+	vector();
+	sim_isr_cycles += sim_cycles() - start;
+	sim_isr_calls++;
+	sim_irq_depth--;
+}
+
+/*************************************************************************
+Function: sim_async_signal()
+Purpose:  timer signal, runs the handler unless the main code is masked
+Input:    signal number
+Returns:  none
+**************************************************************************/
+static void sim_async_signal(int signum){
+	
+	(void)signum;
+	if (sim_irq_depth) {
+		sim_irq_pending = 1;
+		sim_async_deferred++;
+		return;
+	}
+	sim_irq_depth++;
+	sim_async_handler();
+	sim_irq_depth--;
+}
+
+/*************************************************************************
+Function: sim_async_start()
+Purpose:  start the asynchronous interrupts
+Input:    handler, period in microseconds
+Returns:  none
+**************************************************************************/
+void sim_async_start(void (*handler)(void), unsigned period_us){
+	
+	struct sigaction action;
+	struct itimerval timer;
+	
+	sim_async_handler = handler;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = sim_async_signal;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	sigaction(SIGALRM, &action, 0);
+	
+	timer.it_interval.tv_sec = 0;
+	timer.it_interval.tv_usec = period_us;
+	timer.it_value = timer.it_interval;
+	setitimer(ITIMER_REAL, &timer, 0);
+}
+
+/*************************************************************************
+Function: sim_async_stop()
+Purpose:  stop the asynchronous interrupts, runs one held back
+Input:    none
+Returns:  none
+**************************************************************************/
+void sim_async_stop(void){
+	
+	struct itimerval timer;
+	
+	memset(&timer, 0, sizeof(timer));
+	setitimer(ITIMER_REAL, &timer, 0);
+	signal(SIGALRM, SIG_IGN);
+	if (sim_irq_pending && sim_async_handler) {
+		sim_irq_pending = 0;
+		sim_irq_depth++;
+		sim_async_handler();
+		sim_irq_depth--;
+	}
+}
@@ -0,0 +1,54 @@
+/*************************************************************************
+	
+	Host simulation of the MCU around the SPI library
+
+	Register file, interrupt masking and a cycle counter for the host
+	tests. The simulated SPI transfers a byte when it is started:
+
+	- polled (SPIE clear) : reading SPSR in master mode shifts SPDR out to
+	  sim_device and sets SPIF, so each poll loop of the library completes
+	  one byte. A few SPSR accesses outside the loops (settings) clock a
+	  byte too, with CS high, which the devices ignore like a real card.
+	- interrupt driven : the wire of the test (see wire.h) exchanges SPDR
+	  and runs the vector with sim_isr().
+
+*************************************************************************/
+
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+
+/* Register offsets in sim_regs[] */
+#define SIM_SPSR			0x4D
+
+/* Device on the bus, answers MISO for MOSI. Checks its own CS pin */
+typedef uint8_t (*sim_device_fn)(uint8_t mosi);
+extern sim_device_fn sim_device;
+
+extern uint32_t sim_polled_bytes;	// bytes clocked by the polled path
+extern uint32_t sim_isr_calls;		// vectors run by sim_isr()
+extern uint64_t sim_isr_cycles;		// host cycles spent in them
+
+/* Clear the registers and counters, the device is kept */
+extern void sim_reset(void);
+
+/* Run an interrupt vector with the interrupts masked, as the MCU does */
+extern void sim_isr(void (*vector)(void));
+
+/* Host cycle counter (TSC on x86, nanoseconds elsewhere) */
+extern uint64_t sim_cycles(void);
+
+/* Interrupt firing point: called each time the main code leaves its
+   outermost ATOMIC_BLOCK, where a pending interrupt runs on the MCU. The
+   hook runs masked and may clock bytes. */
+extern void (*sim_irq_exit)(void);
+
+/* Asynchronous interrupts for the interleaving fuzzers: handler runs from
+   a timer signal every period_us, at any instruction of the main code
+   outside ATOMIC_BLOCK; inside, it is held pending until the block ends. */
+extern void sim_async_start(void (*handler)(void), unsigned period_us);
+extern void sim_async_stop(void);
+extern uint32_t sim_async_deferred;	// signals held by an ATOMIC_BLOCK
+
+#endif /* SIM_H_ */
@@ -0,0 +1,86 @@
+# Flash and RAM used by SPI.c for each role and option, run by the
+# size_report target: every combination is compiled with SIZE_CC and
+# SIZE_FLAGS (avr-gcc -Os for the MCU by default) and measured with
+# SIZE_TOOL, flash being text + data and RAM data + bss of the object.
+# The table is printed and written to SIZE_OUTPUT in the layout of the
+# README.
+
+cmake_minimum_required(VERSION 3.10)
+
+foreach(var SIZE_CC SIZE_TOOL SIZE_FLAGS SIZE_MASTER_DIR SIZE_SLAVE_DIR SIZE_WORK_DIR SIZE_OUTPUT)
+	if(NOT ${var})
+		message(FATAL_ERROR "size_report: ${var} not set, avr-gcc and avr-size are needed on the PATH")
+	endif()
+endforeach()
+
+# label|role|options, - for none
+set(combinations
+	"Master, 64-byte rings|MASTER|-"
+	"Master, 1024-byte rings|MASTER|SPI_RX_BUFFER_SIZE=1024 SPI_TX_BUFFER_SIZE=1024"
+	"Master, SPI_MINIMAL_ENABLED|MASTER|SPI_MINIMAL_ENABLED"
+	"Master, SPI_BATCH_ENABLED|MASTER|SPI_BATCH_ENABLED"
+	"Master, SPI_TIMEOUT_ENABLED|MASTER|SPI_TIMEOUT_ENABLED"
+	"Master, SPI_READAHEAD_ENABLED|MASTER|SPI_READAHEAD_ENABLED"
+	"Master, SPI_SG_ENABLED|MASTER|SPI_SG_ENABLED"
+	"Master, SPI_EVENTS_ENABLED|MASTER|SPI_EVENTS_ENABLED"
+	"Master, SPI_LATENCY_ENABLED|MASTER|SPI_LATENCY_ENABLED"
+	"Master, SPI_TRACE_ENABLED|MASTER|SPI_TRACE_ENABLED"
+	"Master, SPI_PROFILE_ENABLED|MASTER|SPI_PROFILE_ENABLED"
+	"Master, SPI_SOFT_ENABLED|MASTER|SPI_SOFT_ENABLED"
+	"Slave, 64-byte rings|SLAVE|-"
+	"Slave, SPI_MINIMAL_ENABLED|SLAVE|SPI_MINIMAL_ENABLED"
+	"Slave, SPI_REGMAP_ENABLED|SLAVE|SPI_REGMAP_ENABLED"
+	"Slave, SPI_EVENTS_ENABLED|SLAVE|SPI_EVENTS_ENABLED"
+	"Slave, SPI_BRIDGE_ENABLED|SLAVE|SPI_BRIDGE_ENABLED"
+	"Slave, SPI_LATENCY_ENABLED|SLAVE|SPI_LATENCY_ENABLED"
+	"Slave, SPI_TRACE_ENABLED|SLAVE|SPI_TRACE_ENABLED"
+)
+
+file(MAKE_DIRECTORY ${SIZE_WORK_DIR})
+set(table "")
+set(index 0)
+foreach(combination ${combinations})
+	string(REPLACE "|" ";" fields "${combination}")
+	list(GET fields 0 label)
+	list(GET fields 1 role)
+	list(GET fields 2 options)
+	set(defines -DSPI_${role}_ENABLED)
+	if(NOT options STREQUAL "-")
+		string(REPLACE " " ";" options "${options}")
+		foreach(option ${options})
+			list(APPEND defines -D${option})
+		endforeach()
+	endif()
+	if(role STREQUAL "MASTER")
+		set(dir ${SIZE_MASTER_DIR})
+	else()
+		set(dir ${SIZE_SLAVE_DIR})
+	endif()
+	set(object ${SIZE_WORK_DIR}/spi_${index}.o)
+	math(EXPR index "${index} + 1")
+
+	execute_process(COMMAND ${SIZE_CC} ${SIZE_FLAGS} ${defines} -I${dir} -c ${dir}/SPI.c -o ${object}
+		RESULT_VARIABLE result ERROR_VARIABLE errors)
+	if(NOT result EQUAL 0)
+		message(FATAL_ERROR "size_report: ${label} does not build (${result})\n${errors}")
+	endif()
+	execute_process(COMMAND ${SIZE_TOOL} ${object} OUTPUT_VARIABLE sizes RESULT_VARIABLE result)
+	# Berkeley format: text data bss dec hex filename, below the header
+	if(NOT result EQUAL 0 OR NOT sizes MATCHES "\n[ \t]*([0-9]+)[ \t]+([0-9]+)[ \t]+([0-9]+)")
+		message(FATAL_ERROR "size_report: no sizes for ${label}\n${sizes}")
+	endif()
+	math(EXPR flash "${CMAKE_MATCH_1} + ${CMAKE_MATCH_2}")
+	math(EXPR ram "${CMAKE_MATCH_2} + ${CMAKE_MATCH_3}")
+
+	set(pad "")
+	string(LENGTH "${label}${pad}" length)
+	while(length LESS 32)
+		string(APPEND pad " ")
+		string(LENGTH "${label}${pad}" length)
+	endwhile()
+	string(APPEND table "\t${label}${pad}:\tflash ${flash} bytes, RAM ${ram} bytes\n")
+endforeach()
+
+file(WRITE ${SIZE_OUTPUT} "${table}")
+message("${table}")
+message("written to ${SIZE_OUTPUT}")
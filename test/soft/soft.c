@@ -0,0 +1,356 @@
+/*************************************************************************
+
+	Software SPI against a slave following the pins edge by edge
+
+	The four pins sit on a port of their own (X) whose registers go
+	through soft_port() and soft_pin(), so that the slave sees every
+	write to SCK, MOSI and SS and drives MISO before each read. The slave
+	is built from the datasheet rules for the SPI_SOFT_MODE and
+	SPI_SOFT_BITORDER of the build, not from the library macros:
+
+	- SCK idles at CPOL, SS only falls and rises with SCK idle
+	- CPHA=0: MOSI and MISO are sampled on the leading edge, the next bit
+	  is shifted out on the trailing one, the first bit as SS falls
+	- CPHA=1: the bit is shifted out on the leading edge and sampled on
+	  the trailing one
+	- MOSI only changes while SCK is away from its sampling edge, 16
+	  edges per byte, none with SS high
+
+	Every byte value is exchanged with spi_soft_transfer() and compared
+	both ways, then a string with spi_soft_transmit() and a block with
+	spi_soft_read(), each in one SS window.
+
+	The report gives the pin accesses and the cycles per byte of the
+	software bus next to the polled hardware SPI at every divider: on the
+	AVR each access is one sbi/cbi/sbic, the rest of the bit counted as
+	SOFT_AVR_BIT_CYCLES and the polling of the hardware path as
+	SOFT_AVR_POLL_CYCLES (estimates, replace them with the figures
+	measured on the target), and on the host through the simulation.
+
+*************************************************************************/
+
+#include <stdint.h>
+
+static volatile uint8_t *soft_port(void);
+static volatile uint8_t *soft_pin(void);
+static volatile uint8_t soft_ddr;
+
+#define PORTX			(*soft_port())
+#define PINX			(*soft_pin())
+#define DDRX			soft_ddr
+#define SPI_SOFT_SCK	X, 0
+#define SPI_SOFT_MOSI	X, 1
+#define SPI_SOFT_MISO	X, 2
+#define SPI_SOFT_SS		X, 3
+
+#include "SPI.c"
+#include "wire.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifndef SOFT_AVR_BIT_CYCLES
+#define SOFT_AVR_BIT_CYCLES		4		// MOSI test and skip, MISO or-in, besides the pin accesses
+#endif
+#ifndef SOFT_AVR_POLL_CYCLES
+#define SOFT_AVR_POLL_CYCLES	8		// SPDR write, SPIF loop exit, SPDR read
+#endif
+#define SOFT_AVR_CALL_CYCLES	8		// call and return of spi_soft_transfer()
+
+#define SOFT_SCK	(1<<0)
+#define SOFT_MOSI	(1<<1)
+#define SOFT_MISO	(1<<2)
+#define SOFT_SS		(1<<3)
+#define SOFT_CPOL	((SPI_SOFT_MODE & SPI_MODE2) ? SOFT_SCK : 0)
+#define SOFT_CPHA	((SPI_SOFT_MODE & SPI_MODE1) != 0)
+
+static volatile uint8_t soft_port_value, soft_pin_value;
+static uint32_t soft_accesses;
+
+static struct {
+	uint8_t seen;					// port value already followed
+	uint8_t selected;
+	uint8_t bit;					// bits of the current byte so far
+	uint8_t out, in;				// byte shifted out and in
+	uint8_t next;					// answer of the next byte
+	uint32_t edges, bytes, windows;
+	uint8_t received[512];
+	uint32_t idle, setup, unselected, partial;
+} slave;
+
+static int soft_errors;
+
+/*************************************************************************
+Function: slave_position()
+Purpose:  bit of the byte on the wire at a step, from the bit order
+Input:    step (0 -> 7)
+Returns:  bit number
+**************************************************************************/
+static uint8_t slave_position(uint8_t step){
+
+	return (SPI_SOFT_BITORDER == SPI_LSBFIRST) ? step : 7 - step;
+}
+
+/*************************************************************************
+Function: slave_drive()
+Purpose:  put the current bit of the answer on MISO
+Input:    none
+Returns:  none
+**************************************************************************/
+static void slave_drive(void){
+
+	if (slave.out & (1<<slave_position(slave.bit))) {
+		soft_pin_value |= SOFT_MISO;
+	} else {
+		soft_pin_value &= ~SOFT_MISO;
+	}
+}
+
+/*************************************************************************
+Function: slave_sample()
+Purpose:  take the current bit of MOSI, completes the byte after 8
+Input:    none
+Returns:  none
+**************************************************************************/
+static void slave_sample(void){
+
+	if (soft_port_value & SOFT_MOSI) {
+		slave.in |= (1<<slave_position(slave.bit));
+	}
+	if (++slave.bit == 8) {
+		if (slave.bytes < sizeof(slave.received)) {
+			slave.received[slave.bytes] = slave.in;
+		}
+		slave.bytes++;
+		slave.bit = 0;
+		slave.in = 0;
+		slave.out = slave.next;
+		slave.next += 0x3B;
+	}
+}
+
+/*************************************************************************
+Function: slave_sync()
+Purpose:  follow the pin written since the last access
+Input:    none
+Returns:  none
+**************************************************************************/
+static void slave_sync(void){
+
+	uint8_t port = soft_port_value;
+	uint8_t changed = port ^ slave.seen;
+	uint8_t sck = port & SOFT_SCK;
+
+	slave.seen = port;
+	if (changed & SOFT_SS) {
+		if (sck != SOFT_CPOL) {
+			slave.idle++;
+		}
+		slave.selected = !(port & SOFT_SS);
+		if (slave.selected) {
+			slave.windows++;
+			slave.bit = 0;
+			slave.in = 0;
+			if (!SOFT_CPHA) {
+				slave_drive();
+			}
+		} else if (slave.bit) {
+			slave.partial++;
+		}
+	}
+	if (changed & SOFT_MOSI) {
+		// CPHA=0 samples as SCK leaves idle, CPHA=1 as it comes back
+		if (slave.selected && ((sck != SOFT_CPOL) != SOFT_CPHA)) {
+			slave.setup++;
+		}
+	}
+	if (changed & SOFT_SCK) {
+		if (!slave.selected) {
+			slave.unselected++;
+			return;
+		}
+		slave.edges++;
+		if (sck != SOFT_CPOL) {
+			// leading edge
+			if (SOFT_CPHA) {
+				slave_drive();
+			} else {
+				slave_sample();
+			}
+		} else {
+			// trailing edge
+			if (SOFT_CPHA) {
+				slave_sample();
+			} else {
+				slave_drive();
+			}
+		}
+	}
+}
+
+/*************************************************************************
+Function: soft_port()
+Purpose:  port register of the software SPI pins
+Input:    none
+Returns:  register, the write is seen at the next access
+**************************************************************************/
+static volatile uint8_t *soft_port(void){
+
+	soft_accesses++;
+	slave_sync();
+	return &soft_port_value;
+}
+
+/*************************************************************************
+Function: soft_pin()
+Purpose:  input register of the software SPI pins, MISO up to date
+Input:    none
+Returns:  register
+**************************************************************************/
+static volatile uint8_t *soft_pin(void){
+
+	soft_accesses++;
+	slave_sync();
+	return &soft_pin_value;
+}
+
+/*************************************************************************
+Function: soft_check()
+Purpose:  report the rule violations seen by the slave so far
+Input:    what is checked
+Returns:  none
+**************************************************************************/
+static void soft_check(const char *what){
+
+	slave_sync();
+	if (slave.idle || slave.setup || slave.unselected || slave.partial) {
+		printf("FAIL %s: %u SS edges with SCK active, %u MOSI changes at sampling, "
+			"%u SCK edges with SS high, %u partial bytes\n", what,
+			slave.idle, slave.setup, slave.unselected, slave.partial);
+		soft_errors++;
+		slave.idle = slave.setup = slave.unselected = slave.partial = 0;
+	}
+}
+
+/*************************************************************************
+Function: soft_hardware()
+Purpose:  sim_device of the hardware path, answers the byte back inverted
+Input:    MOSI
+Returns:  MISO
+**************************************************************************/
+static uint8_t soft_hardware(uint8_t mosi){
+
+	return ~mosi;
+}
+
+int main(void){
+
+	static const uint8_t clocks[] = {
+		SPI_CLOCK_DIV2, SPI_CLOCK_DIV4, SPI_CLOCK_DIV8, SPI_CLOCK_DIV16,
+		SPI_CLOCK_DIV32, SPI_CLOCK_DIV64, SPI_CLOCK_DIV128
+	};
+	uint8_t answer, got, block[64];
+	uint32_t i, edges, accesses;
+	uint64_t start, soft_host, hard_host;
+	unsigned long divider, cycles, soft_cycles;
+
+	sim_reset();
+	spi_soft_init();
+	if (soft_ddr != (SOFT_SCK|SOFT_MOSI|SOFT_SS) || (soft_port_value & (SOFT_SCK|SOFT_SS)) != (SOFT_CPOL|SOFT_SS)) {
+		printf("FAIL spi_soft_init: DDR %02X PORT %02X\n", soft_ddr, soft_port_value);
+		soft_errors++;
+	}
+	// the slave is attached to the pins once they are driven, they were
+	// floating inputs before
+	slave.seen = soft_port_value;
+	slave.idle = slave.unselected = 0;
+
+	// every byte value, one SS window, checked byte by byte
+	spi_soft_select();
+	slave_sync();
+	start = sim_cycles();
+	for (i = 0; i < 256; i++) {
+		answer = slave.out;
+		edges = slave.edges;
+		got = spi_soft_transfer((uint8_t)i);
+		slave_sync();
+		if (got != answer || slave.bytes != i + 1 || slave.received[i] != i || slave.edges - edges != 16) {
+			printf("FAIL byte %02X: slave got %02X, answered %02X and the master read %02X, %u edges\n",
+				i, slave.received[i], answer, got, slave.edges - edges);
+			soft_errors++;
+			break;
+		}
+	}
+	soft_host = sim_cycles() - start;
+	spi_soft_deselect();
+	soft_check("spi_soft_transfer");
+
+	// the pin accesses of one byte, each a single instruction on the AVR
+	spi_soft_select();
+	slave_sync();
+	accesses = soft_accesses;
+	spi_soft_transfer(0xA5);
+	accesses = soft_accesses - accesses;
+	spi_soft_deselect();
+	soft_check("one byte");
+
+	// strings and reads each in their own window
+	slave.bytes = 0;
+	slave.windows = 0;
+	spi_soft_transmit("HELLO WORLD");
+	soft_check("spi_soft_transmit");
+	if (slave.bytes != 11 || slave.windows != 1 || memcmp(slave.received, "HELLO WORLD", 11) != 0) {
+		printf("FAIL spi_soft_transmit: %u bytes in %u windows\n", slave.bytes, slave.windows);
+		soft_errors++;
+	}
+	slave.bytes = 0;
+	answer = slave.out;
+	spi_soft_read(block, sizeof(block));
+	soft_check("spi_soft_read");
+	for (i = 0; i < sizeof(block); i++) {
+		if (block[i] != answer || (i < slave.bytes && slave.received[i] != 0x00)) {
+			printf("FAIL spi_soft_read: byte %u is %02X instead of %02X\n", i, block[i], answer);
+			soft_errors++;
+			break;
+		}
+		answer += 0x3B;
+	}
+	if (slave.bytes != sizeof(block) || slave.windows != 2 || !(soft_port_value & SOFT_SS)) {
+		printf("FAIL spi_soft_read: %u bytes in %u windows\n", slave.bytes, slave.windows - 1);
+		soft_errors++;
+	}
+
+	// the hardware path, polled, for the comparison
+	sim_device = soft_hardware;
+	spi_master_init(SPI_MODE0, SPI_CLOCK_DIV2);
+	spi_master_acquire();
+	start = sim_cycles();
+	for (i = 0; i < 256; i++) {
+		if (spi_master_exchange((uint8_t)i) != (uint8_t)~i) {
+			printf("FAIL hardware exchange of %02X\n", i);
+			soft_errors++;
+			break;
+		}
+	}
+	hard_host = sim_cycles() - start;
+	spi_master_release();
+
+	soft_cycles = 2UL * accesses + 8UL * SOFT_AVR_BIT_CYCLES + SOFT_AVR_CALL_CYCLES;
+	printf("F_CPU %luHz, mode %u %s first, %u pin accesses per byte\n\n", (unsigned long)F_CPU,
+		SPI_SOFT_MODE >> 2, SPI_SOFT_BITORDER == SPI_LSBFIRST ? "LSB" : "MSB", accesses);
+	printf("path        AVR cycles   AVR(B/s)  host cycles\n");
+	printf("              per byte             per byte\n");
+	printf("software    %10lu %10lu %12.0f\n", soft_cycles, (unsigned long)F_CPU / soft_cycles,
+		(double)soft_host / 256);
+	for (i = 0; i < sizeof(clocks); i++) {
+		divider = SPI_CLOCK_DIVIDER(clocks[i]);
+		cycles = 8 * divider + SOFT_AVR_POLL_CYCLES;
+		printf("DIV%-8lu %10lu %10lu %12.0f\n", divider, cycles, (unsigned long)F_CPU / cycles,
+			(double)hard_host / 256);
+	}
+
+	if (soft_errors) {
+		printf("\n%d error(s)\n", soft_errors);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,20 @@
+/*************************************************************************
+	
+	Host stand-in for <avr/interrupt.h>
+
+	A vector is a plain function, run by the simulated wire through
+	sim_isr() with interrupts masked as on the MCU.
+
+*************************************************************************/
+
+#ifndef SIM_AVR_INTERRUPT_H_
+#define SIM_AVR_INTERRUPT_H_
+
+#define ISR(vector, ...)	void vector(void)
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+
+#define sei()
+#define cli()
+
+#endif /* SIM_AVR_INTERRUPT_H_ */
@@ -0,0 +1,86 @@
+/*************************************************************************
+	
+	Host stand-in for <avr/io.h>, registers of the simulated MCU
+
+	The registers live in sim_regs[], at their data space address. SPSR
+	goes through sim_spsr() so that a polled transfer completes when it is
+	polled, see sim.h.
+
+*************************************************************************/
+
+#ifndef SIM_AVR_IO_H_
+#define SIM_AVR_IO_H_
+
+#include <stdint.h>
+
+extern volatile uint8_t sim_regs[256];
+extern volatile uint16_t sim_tcnt1;
+extern volatile uint8_t *sim_spsr(void);
+
+#define _SFR_MEM8(addr)		(sim_regs[(addr)])
+#define _SFR_IO8(addr)		(sim_regs[(addr) + 0x20])
+
+/* Ports */
+#define PINA		_SFR_IO8(0x00)
+#define DDRA		_SFR_IO8(0x01)
+#define PORTA		_SFR_IO8(0x02)
+#define PINB		_SFR_IO8(0x03)
+#define DDRB		_SFR_IO8(0x04)
+#define PORTB		_SFR_IO8(0x05)
+#define PINC		_SFR_IO8(0x06)
+#define DDRC		_SFR_IO8(0x07)
+#define PORTC		_SFR_IO8(0x08)
+#define PIND		_SFR_IO8(0x09)
+#define DDRD		_SFR_IO8(0x0A)
+#define PORTD		_SFR_IO8(0x0B)
+
+/* SPI */
+#define SPCR		_SFR_IO8(0x2C)
+#define SPSR		(*sim_spsr())
+#define SPDR		_SFR_IO8(0x2E)
+#define SPIE		7
+#define SPE			6
+#define DORD		5
+#define MSTR		4
+#define CPOL		3
+#define CPHA		2
+#define SPR1		1
+#define SPR0		0
+#define SPIF		7
+#define WCOL		6
+#define SPI2X		0
+
+#define SREG		_SFR_IO8(0x3F)
+
+/* Pin change interrupts */
+#define PCICR		_SFR_MEM8(0x68)
+#define PCMSK0		_SFR_MEM8(0x6B)
+#define PCMSK1		_SFR_MEM8(0x6C)
+#define PCIE0		0
+#define PCIE1		1
+#define PCINT2		2
+#define PCINT12		4
+
+/* Timer 1 */
+#define TCNT1		sim_tcnt1
+
+/* USART0 */
+#define UCSR0A		_SFR_MEM8(0xC0)
+#define UCSR0B		_SFR_MEM8(0xC1)
+#define UCSR0C		_SFR_MEM8(0xC2)
+#define UBRR0L		_SFR_MEM8(0xC4)
+#define UBRR0H		_SFR_MEM8(0xC5)
+#define UBRR0		(*(volatile uint16_t *)&sim_regs[0xC4])
+#define UDR0		_SFR_MEM8(0xC6)
+#define RXEN0		4
+#define TXEN0		3
+#define UDRE0		5
+#define UDRIE0		5
+#define UCPOL0		0
+#define UCPHA0		1
+#define UCSZ00		1
+#define UCSZ01		2
+#define UMSEL00		6
+#define UMSEL01		7
+
+#endif /* SIM_AVR_IO_H_ */
@@ -0,0 +1,16 @@
+/*************************************************************************
+	
+	Host stand-in for <avr/pgmspace.h>, flash is ordinary memory
+
+*************************************************************************/
+
+#ifndef SIM_AVR_PGMSPACE_H_
+#define SIM_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(s)				(s)
+#define pgm_read_byte(p)	(*(const uint8_t *)(p))
+
+#endif /* SIM_AVR_PGMSPACE_H_ */
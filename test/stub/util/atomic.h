@@ -0,0 +1,29 @@
+/*************************************************************************
+	
+	Host stand-in for <util/atomic.h>
+
+	ATOMIC_BLOCK masks the simulated interrupts like the avr-libc version
+	clears the I bit: an interrupt raised meanwhile (by the fuzzer signal)
+	is held pending and runs when the outermost block is left, on every
+	exit path thanks to the cleanup attribute.
+
+*************************************************************************/
+
+#ifndef SIM_UTIL_ATOMIC_H_
+#define SIM_UTIL_ATOMIC_H_
+
+#include <stdint.h>
+
+extern uint8_t sim_irq_mask(void);
+extern void sim_irq_unmask(const uint8_t *unused);
+
+#define ATOMIC_RESTORESTATE		0
+#define ATOMIC_FORCEON			0
+#define NONATOMIC_RESTORESTATE	0
+#define NONATOMIC_FORCEOFF		0
+
+#define ATOMIC_BLOCK(type) \
+	for (uint8_t sim_masked __attribute__((__cleanup__(sim_irq_unmask))) = sim_irq_mask(), sim_todo = 1; \
+		 sim_todo; sim_todo = 0)
+
+#endif /* SIM_UTIL_ATOMIC_H_ */
@@ -0,0 +1,13 @@
+/*************************************************************************
+	
+	Host stand-in for <util/delay.h>, delays take no time
+
+*************************************************************************/
+
+#ifndef SIM_UTIL_DELAY_H_
+#define SIM_UTIL_DELAY_H_
+
+#define _delay_ms(ms)		((void)(ms))
+#define _delay_us(us)		((void)(us))
+
+#endif /* SIM_UTIL_DELAY_H_ */
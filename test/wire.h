@@ -0,0 +1,167 @@
+/*************************************************************************
+	
+	Simulated SPI wire, included after SPI.c by the host tests
+
+	The tests build SPI.c in the same translation unit, so the wire knows
+	from the library state when a byte is in flight. Each byte exchanged
+	is logged with the SS level after its interrupt.
+
+*************************************************************************/
+
+#ifndef WIRE_H_
+#define WIRE_H_
+
+#include "sim.h"
+
+#define WIRE_LOG_SIZE		8192
+
+static uint8_t wire_mosi[WIRE_LOG_SIZE];
+static uint8_t wire_miso[WIRE_LOG_SIZE];
+static uint8_t wire_end[WIRE_LOG_SIZE];		// 1 if SS went high after the byte
+static uint32_t wire_bytes;					// bytes exchanged, the log keeps the first ones
+static uint32_t wire_transactions;			// SS rises after a byte
+static uint8_t wire_stalled;				// clock stopped, bytes never complete
+static uint8_t wire_slave_open;				// slave: bytes clocked since SS went low
+
+/*************************************************************************
+Function: wire_log()
+Purpose:  record one byte of the bus
+Input:    MOSI, MISO, SS put high after the byte
+Returns:  none
+**************************************************************************/
+static inline void wire_log(uint8_t mosi, uint8_t miso, uint8_t end){
+	
+	if (wire_bytes < WIRE_LOG_SIZE) {
+		wire_mosi[wire_bytes] = mosi;
+		wire_miso[wire_bytes] = miso;
+		wire_end[wire_bytes] = end;
+	}
+	wire_bytes++;
+	if (end) {
+		wire_transactions++;
+	}
+}
+
+/*************************************************************************
+Function: wire_clear()
+Purpose:  empty the log
+Input:    none
+Returns:  none
+**************************************************************************/
+static inline void wire_clear(void){
+	
+	wire_bytes = 0;
+	wire_transactions = 0;
+	wire_stalled = 0;
+	wire_slave_open = 0;
+}
+
+#if defined (SPI_MASTER_ENABLED)
+/*************************************************************************
+Function: wire_master_busy()
+Purpose:  tell if the interrupt driven master has a byte in flight
+Input:    none
+Returns:  1 if a byte is shifting
+**************************************************************************/
+static inline uint8_t wire_master_busy(void){
+	
+	if (wire_stalled || SPI_CTS != SPI_ACTIVE || !(SPCR & (1<<SPIE)) || !(SPCR & (1<<SPE))) {
+		return 0;
+	}
+	#if defined (SPI_READAHEAD_ENABLED)
+	if (SPI_Stream == SPI_STREAM_PAUSED) {
+		return 0;	// SS held low, nothing clocked until the buffer drains
+	}
+	#endif
+	return 1;
+}
+
+/*************************************************************************
+Function: wire_master_clock()
+Purpose:  complete the byte in flight and run the SPI interrupt
+Input:    MISO answered by the slave
+Returns:  MOSI sent by the master
+**************************************************************************/
+static inline uint8_t wire_master_clock(uint8_t miso){
+	
+	uint8_t mosi = SPDR;
+	
+	SPDR = miso;
+	sim_regs[SIM_SPSR] |= (1<<SPIF);
+	sim_isr(SPI_STC_vect);
+	sim_regs[SIM_SPSR] &= ~(1<<SPIF);
+	wire_log(mosi, miso, (SPI_PORT & (1<<SPI_PIN_SS)) != 0);
+	
+	return mosi;
+}
+
+/*************************************************************************
+Function: wire_master_run()
+Purpose:  clock the bytes in flight against sim_device
+Input:    maximum number of bytes
+Returns:  number of bytes clocked
+**************************************************************************/
+static inline uint32_t wire_master_run(uint32_t max){
+	
+	uint32_t count = 0;
+	
+	while (count < max && wire_master_busy()) {
+		wire_master_clock(sim_device ? sim_device(SPDR) : 0xFF);
+		count++;
+	}
+	return count;
+}
+#endif
+
+#if defined (SPI_SLAVE_ENABLED)
+/*************************************************************************
+Function: wire_slave_select()
+Purpose:  drive SS of the slave, runs the pin change interrupt if enabled
+Input:    1 to select (SS low), 0 to deselect
+Returns:  none
+**************************************************************************/
+static inline void wire_slave_select(uint8_t selected){
+	
+	uint8_t level = selected ? 0 : (1<<SPI_PIN_SS);
+	
+	if ((SPI_PIN & (1<<SPI_PIN_SS)) == level) {
+		return;
+	}
+	SPI_PIN = (SPI_PIN & ~(1<<SPI_PIN_SS)) | level;
+	// logged as the end of the last byte, as on the master side
+	if (!selected && wire_slave_open) {
+		if (wire_bytes <= WIRE_LOG_SIZE) {
+			wire_end[wire_bytes - 1] = 1;
+		}
+		wire_transactions++;
+		wire_slave_open = 0;
+	}
+	#if defined (SPI_REGMAP_ENABLED)
+	if ((PCICR & (1<<SPI_SS_PCIE)) && (SPI_SS_PCMSK & (1<<SPI_SS_PCINT))) {
+		sim_isr(SPI_SS_vect);
+	}
+	#endif
+}
+
+/*************************************************************************
+Function: wire_slave_clock()
+Purpose:  complete a byte clocked by the master and run the SPI interrupt
+Input:    MOSI sent by the master
+Returns:  MISO answered
+**************************************************************************/
+static inline uint8_t wire_slave_clock(uint8_t mosi){
+	
+	uint8_t miso = SPDR;
+	
+	SPDR = mosi;
+	sim_regs[SIM_SPSR] |= (1<<SPIF);
+	sim_isr(SPI_STC_vect);
+	sim_regs[SIM_SPSR] &= ~(1<<SPIF);
+	wire_log(mosi, miso, (SPI_PIN & (1<<SPI_PIN_SS)) != 0);
+	wire_slave_open = 1;
+	
+	return miso;
+}
+#endif
+
+#endif /* WIRE_H_ */